@@ -0,0 +1,312 @@
+/* Benchmark harness. Generates scaling workloads, runs the scanner, parser and interpreter stages on each
+   one in-process, and prints median/p99 wall time, allocations and peak RSS per stage as JSON.
+
+   Build: g++ -std=c++11 -O2 bench/benchmark.cpp -o benchmark.exe
+   Usage: ./benchmark.exe [--repeat R] [--scale F] [--tree] [--no-optimize] [--lex-jobs N] [--workload NAME] */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/interpreter.cpp"
+#include "../src/lexer.cpp"
+#include "../src/output.cpp"
+#include "../src/parser.cpp"
+#include "../src/scanner.cpp"
+
+using namespace std;
+
+/* Every allocation in the process goes through these, so a stage's allocations are the difference across it.
+   They are a malloc/free pair, but GCC takes a new-expression to allocate with its own operator new, so
+   where it inlines the delete into one it reports free() as mismatched. The operators are kept out of line,
+   where the pairing is visible as the one defined here */
+static size_t allocation_count = 0;
+static size_t allocation_bytes = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocation_count++;
+    allocation_bytes += size;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw bad_alloc();
+    return memory;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+/* Counts a tail-recursive loop from n down to 1, running body with i bound to the counter */
+static string loop(const string& name, const string& body, int n) {
+    ostringstream out;
+    out << "def " << name << "(i):\n"
+        << "    if i > 0:\n"
+        << "        " << body << "\n"
+        << "        return " << name << "(i - 1)\n"
+        << name << "(" << n << ")\n";
+    return out.str();
+}
+
+/* One long left-associative expression of n terms, evaluated a hundred times */
+static string expression_chain(int n) {
+    ostringstream out;
+    out << "def chain(x):\n    return x";
+    for (int i = 1; i < n; i++) out << (i % 3 == 0 ? " - x * " : " + ") << i % 7;
+    out << "\n" << loop("repeat", "y = chain(i)", 100);
+    return out.str();
+}
+
+/* Non-tail recursion n frames deep */
+static string recursion(int n) {
+    ostringstream out;
+    out << "def depth(n):\n"
+        << "    if n == 0:\n"
+        << "        return 0\n"
+        << "    return 1 + depth(n - 1)\n"
+        << "print(depth(" << n << "))\n";
+    return out.str();
+}
+
+/* An if/else nested n levels deep inside a function, taken all the way down a hundred times */
+static string nested_conditionals(int n) {
+    ostringstream out;
+    out << "def nested(x):\n";
+    for (int level = 0; level < n; level++) {
+        string indent((level + 1) * 4, ' ');
+        out << indent << "if x > " << -level << ":\n";
+        if (level == n - 1) out << indent << "    return " << level << "\n";
+        else {
+            out << indent << "    x = x + 1\n";
+            out << indent << "else:\n" << indent << "    return 0\n";
+        }
+    }
+    out << loop("repeat", "y = nested(i)", 100);
+    return out.str();
+}
+
+/* n module-level variables, each assigned twice so none can be propagated as a constant */
+static string many_globals(int n) {
+    ostringstream out;
+    for (int i = 0; i < n; i++) out << "g" << i << " = " << i << "\n";
+    for (int i = 1; i < n; i++) out << "g" << i << " = g" << i << " + g" << i - 1 << "\n";
+    out << "print(g" << n - 1 << ")\n";
+    return out.str();
+}
+
+/* n lines of mixed print output */
+static string print_loop(int n) {
+    return loop("lines", "print(\"line\", i, i * 2, i > 10)", n);
+}
+
+/* A string built by n concatenations onto an accumulator, compared and printed once */
+static string string_building(int n) {
+    ostringstream out;
+    out << "def build(i, s):\n"
+        << "    if i > 0:\n"
+        << "        return build(i - 1, s + \"piece \")\n"
+        << "    return s\n"
+        << "report = build(" << n << ", \"\")\n"
+        << "print(report == build(" << n << ", \"\"))\n"
+        << "print(report)\n";
+    return out.str();
+}
+
+/* A sum over range(n) and a while loop counting n down, the native forms of the iteration loop() spells
+   as tail calls */
+static string native_loops(int n) {
+    ostringstream out;
+    out << "total = 0\n"
+        << "for i in range(" << n << "):\n"
+        << "    total = total + i * 2\n"
+        << "k = " << n << "\n"
+        << "while k > 0:\n"
+        << "    k = k - 1\n"
+        << "print(total, k)\n";
+    return out.str();
+}
+
+struct Workload {
+    string name;
+    int size;
+    string (*generate)(int);
+};
+
+struct StageSamples {
+    vector<double> milliseconds;
+    size_t allocations = 0;
+    size_t allocated_bytes = 0;
+};
+
+struct Options {
+    int repeat = 20;
+    double scale = 1;
+    bool tree_mode = false;
+    bool optimize = true;
+    size_t lex_jobs = 0;
+    string only;
+};
+
+typedef chrono::steady_clock Clock;
+
+static double elapsed_ms(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+static double percentile(vector<double> samples, double fraction) {
+    sort(samples.begin(), samples.end());
+    size_t rank = (size_t) ceil(fraction * samples.size());
+    return samples[rank == 0 ? 0 : rank - 1];
+}
+
+static void print_stage(const char* name, const StageSamples& stage, bool last) {
+    printf("      \"%s\": {\"median_ms\": %.4f, \"p99_ms\": %.4f, \"allocations\": %zu, \"allocated_bytes\": %zu}%s\n",
+           name, percentile(stage.milliseconds, 0.5), percentile(stage.milliseconds, 0.99),
+           stage.allocations, stage.allocated_bytes, last ? "" : ",");
+}
+
+/* Runs one workload Options::repeat times. Allocations are those of the last repetition, since every run is the same */
+static void run_workload(const Workload& workload, const Options& options) {
+    int size = max(1, (int) (workload.size * options.scale));
+    string source = workload.generate(size);
+    StageSamples scan, parse, interpret;
+
+    /* Program output goes to /dev/null, so print-heavy workloads measure the interpreter and not the terminal */
+    FILE* null_output = fopen("/dev/null", "w");
+    output().redirect(null_output);
+    for (int run = 0; run < options.repeat; run++) {
+        size_t count = allocation_count, bytes = allocation_bytes;
+        Clock::time_point start = Clock::now();
+        if (options.lex_jobs > 0) {
+            TokenBuffer buffer;
+            buffer.scan(source.data(), source.size(), options.lex_jobs);
+        } else {
+            Scanner tokens(source.data(), source.size());
+            while (tokens.get_next_token().type != Token::EOF_TOKEN) {}
+        }
+        scan.milliseconds.push_back(elapsed_ms(start));
+        scan.allocations = allocation_count - count;
+        scan.allocated_bytes = allocation_bytes - bytes;
+
+        Scanner scanner(source.data(), source.size());
+        Parser parser(scanner);
+        parser.LEX_JOBS = options.lex_jobs;
+        Interpreter interpreter(parser);
+        interpreter.TREE_MODE = options.tree_mode;
+        interpreter.OPTIMIZE = options.optimize;
+        interpreter.RECURSION_LIMIT = max((size_t) size * 2, DEFAULT_RECURSION_LIMIT);
+
+        count = allocation_count, bytes = allocation_bytes;
+        start = Clock::now();
+        AST* tree = interpreter.prepare();
+        parse.milliseconds.push_back(elapsed_ms(start));
+        parse.allocations = allocation_count - count;
+        parse.allocated_bytes = allocation_bytes - bytes;
+
+        count = allocation_count, bytes = allocation_bytes;
+        start = Clock::now();
+        interpreter.run(tree);
+        interpret.milliseconds.push_back(elapsed_ms(start));
+        interpret.allocations = allocation_count - count;
+        interpret.allocated_bytes = allocation_bytes - bytes;
+    }
+    output().redirect(stdout);
+    fclose(null_output);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  {\n");
+    printf("    \"workload\": \"%s\", \"size\": %d, \"source_bytes\": %zu, \"repeat\": %d, \"backend\": \"%s\", \"optimize\": %s,\n",
+           workload.name.c_str(), size, source.size(), options.repeat, options.tree_mode ? "tree" : "vm",
+           options.optimize ? "true" : "false");
+    printf("    \"stages\": {\n");
+    print_stage("scan", scan, false);
+    print_stage("parse", parse, false);
+    print_stage("interpret", interpret, true);
+    printf("    },\n");
+    printf("    \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+    printf("  }");
+}
+
+int main(int argc, char* argv[]) {
+    vector<Workload> workloads = {
+        {"expression_chain", 2000, expression_chain},
+        {"recursion", 5000, recursion},
+        {"nested_conditionals", 200, nested_conditionals},
+        {"many_globals", 5000, many_globals},
+        {"print_loop", 20000, print_loop},
+        {"string_building", 20000, string_building},
+        {"native_loops", 100000, native_loops},
+    };
+
+    Options options;
+    bool bad_args = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) options.repeat = max(1, atoi(argv[++i]));
+        else if (arg == "--scale" && i + 1 < argc) options.scale = atof(argv[++i]);
+        else if (arg == "--tree") options.tree_mode = true;
+        else if (arg == "--no-optimize") options.optimize = false;
+        else if (arg == "--lex-jobs" && i + 1 < argc) options.lex_jobs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--workload" && i + 1 < argc) options.only = argv[++i];
+        else bad_args = true;
+    }
+    if (bad_args || options.scale <= 0) {
+        cerr << "Usage: " << argv[0] << " [--repeat R] [--scale F] [--tree] [--no-optimize] [--lex-jobs N] [--workload NAME]" << endl;
+        return 1;
+    }
+
+    /* Each workload runs in its own process so its peak RSS is not hidden by an earlier, larger one */
+    int failures = 0;
+    bool first = true;
+    printf("[\n");
+    for (const Workload& workload : workloads) {
+        if (!options.only.empty() && workload.name != options.only) continue;
+        if (!first) printf(",\n");
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            try {
+                run_workload(workload, options);
+            } catch (const exception& error) {
+                cerr << workload.name << ": " << error.what() << endl;
+                fflush(stdout);
+                _exit(1);
+            }
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failures++;
+            printf("  {\"workload\": \"%s\", \"error\": true}", workload.name.c_str());
+        }
+        first = false;
+    }
+    printf("\n]\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/* Print throughput benchmark. Writes the same lines through the old print path (a std::string per call,
+   to_string for integers, cout <<) and through OutputSink, with stdout pointed at /dev/null, and prints
+   the time and throughput of each as JSON.
+
+   Build: g++ -std=c++11 -O2 bench/output_benchmark.cpp -o output_benchmark.exe
+   Usage: ./output_benchmark.exe [--lines N] [--repeat R] */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../src/output.cpp"
+#include "../src/value.cpp"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/* The line print("line", i, i * 2, i > 10) would produce */
+static void make_line(vector<Value>& line, const Value& label, int i) {
+    line.clear();
+    line.push_back(label);
+    line.push_back(Value::make_int(i));
+    line.push_back(Value::make_int(i * 2));
+    line.push_back(Value::make_bool(i > 10));
+}
+
+/* What visit_PrintFunction did before OutputSink */
+static void legacy_print(const vector<Value>& values) {
+    string result = "";
+    for (const Value& value : values) {
+        if (value.type == Value::STRING) result += value.text();
+        else if (value.type == Value::BOOL) result += (value.boolean ? "True" : "False");
+        else if (value.type == Value::INT) result += to_string(value.integer);
+        result += " ";
+    }
+    result[result.length()-1] = '\n';
+    cout << result;
+}
+
+static double percentile(vector<double> samples, double fraction) {
+    sort(samples.begin(), samples.end());
+    size_t rank = (size_t) ceil(fraction * samples.size());
+    return samples[rank == 0 ? 0 : rank - 1];
+}
+
+static void print_path(const char* name, const vector<double>& samples, int lines, size_t bytes, bool last) {
+    double median = percentile(samples, 0.5);
+    printf("    \"%s\": {\"median_ms\": %.4f, \"p99_ms\": %.4f, \"lines_per_sec\": %.0f, \"mb_per_sec\": %.2f}%s\n",
+           name, median, percentile(samples, 0.99), lines / (median / 1000), bytes / (median / 1000) / 1e6,
+           last ? "" : ",");
+}
+
+int main(int argc, char* argv[]) {
+    int lines = 1000000;
+    int repeat = 10;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--lines" && i + 1 < argc) lines = max(1, atoi(argv[++i]));
+        else if (arg == "--repeat" && i + 1 < argc) repeat = max(1, atoi(argv[++i]));
+        else {
+            cerr << "Usage: " << argv[0] << " [--lines N] [--repeat R]" << endl;
+            return 1;
+        }
+    }
+
+    Value label = Value::make_string("line");
+    vector<Value> line;
+    size_t bytes = 0;
+    for (int i = 0; i < lines; i++) bytes += 4 + 1 + to_string(i).size() + 1 + to_string(i * 2).size() + 1 + (i > 10 ? 4 : 5) + 1;
+
+    /* Both paths write to the real stdout descriptor, pointed at /dev/null while measuring */
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    output().redirect(stdout);
+
+    vector<double> legacy, sink;
+    for (int run = 0; run < repeat; run++) {
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < lines; i++) {
+            make_line(line, label, i);
+            legacy_print(line);
+        }
+        cout.flush();
+        fflush(stdout);
+        legacy.push_back(chrono::duration<double, milli>(Clock::now() - start).count());
+
+        start = Clock::now();
+        for (int i = 0; i < lines; i++) {
+            make_line(line, label, i);
+            output().print(line.data(), line.size());
+        }
+        output().flush();
+        fflush(stdout);
+        sink.push_back(chrono::duration<double, milli>(Clock::now() - start).count());
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(null_fd);
+
+    printf("{\n");
+    printf("  \"lines\": %d, \"bytes\": %zu, \"repeat\": %d,\n", lines, bytes, repeat);
+    printf("  \"paths\": {\n");
+    print_path("iostream", legacy, lines, bytes, false);
+    print_path("output_sink", sink, lines, bytes, true);
+    printf("  },\n");
+    printf("  \"speedup\": %.2f\n", percentile(legacy, 0.5) / percentile(sink, 0.5));
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* Quickening micro-benchmark. Prepares each script once, then runs it repeatedly on both backends with
+   operator quickening off and on, and prints the median run time of each as JSON. The optimizer is off
+   by default, since it folds most of the arithmetic in the phase2 tests away before it can run.
+
+   Build: g++ -std=c++11 -O2 -pthread bench/quicken_benchmark.cpp -o quicken_benchmark.exe
+   Usage: ./quicken_benchmark.exe [--repeat R] [--optimize] [--root DIR] [script.py ...]
+   With no scripts, runs testcases/phase2/in01.py to in21.py under DIR, by default the directory the
+   executable is in. Exits with 1 when a script could not be run */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../src/interpreter.cpp"
+#include "../src/output.cpp"
+#include "../src/parser.cpp"
+#include "../src/scanner.cpp"
+#include "../src/source.cpp"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double percentile(vector<double> samples, double fraction) {
+    sort(samples.begin(), samples.end());
+    size_t rank = (size_t) ceil(fraction * samples.size());
+    return samples[rank == 0 ? 0 : rank - 1];
+}
+
+/* Median microseconds of one run of an already prepared script. The walker quickens on the first run
+   and keeps its specialized sites for the rest; the VM compiles, and so quickens, afresh every run */
+static double time_runs(const SourceFile& source, bool tree_mode, bool quicken, bool optimize, int repeat) {
+    Scanner scanner(source.data(), source.size());
+    Parser parser(scanner);
+    Interpreter interpreter(parser);
+    interpreter.TREE_MODE = tree_mode;
+    interpreter.OPTIMIZE = optimize;
+    interpreter.QUICKEN = quicken;
+    AST* tree = interpreter.prepare();
+
+    vector<double> samples;
+    for (int run = 0; run < repeat; run++) {
+        Clock::time_point start = Clock::now();
+        interpreter.run(tree);
+        samples.push_back(chrono::duration<double, micro>(Clock::now() - start).count());
+    }
+    return percentile(samples, 0.5);
+}
+
+static void print_backend(const char* name, double generic, double quickened, bool last) {
+    printf("\"%s\": {\"generic_us\": %.3f, \"quickened_us\": %.3f, \"speedup\": ", name, generic, quickened);
+    /* JSON has no NaN or infinity, which a run too fast to measure would give */
+    double speedup = generic / quickened;
+    if (isfinite(speedup)) printf("%.2f}%s", speedup, last ? "" : ", ");
+    else printf("null}%s", last ? "" : ", ");
+}
+
+/* The directory part of path, with its trailing slash, or "" for a bare name */
+static string directory_of(const string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+int main(int argc, char* argv[]) {
+    int repeat = 2000;
+    bool optimize = false;
+    string root = directory_of(argv[0]);
+    vector<string> scripts;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) repeat = max(1, atoi(argv[++i]));
+        else if (arg == "--optimize") optimize = true;
+        else if (arg == "--root" && i + 1 < argc) root = string(argv[++i]) + "/";
+        else if (arg[0] != '-') scripts.push_back(arg);
+        else {
+            cerr << "Usage: " << argv[0] << " [--repeat R] [--optimize] [--root DIR] [script.py ...]" << endl;
+            return 1;
+        }
+    }
+    if (scripts.empty()) {
+        for (int i = 1; i <= 21; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "testcases/phase2/in%02d.py", i);
+            scripts.push_back(root + name);
+        }
+    }
+
+    /* Program output goes to /dev/null, so the runs measure the interpreter and not the terminal */
+    FILE* null_output = fopen("/dev/null", "w");
+    output().redirect(null_output);
+
+    double totals[2][2] = {{0, 0}, {0, 0}};
+    int failures = 0;
+    size_t measured = 0;
+    printf("{\n  \"repeat\": %d, \"optimize\": %s,\n  \"scripts\": [\n", repeat, optimize ? "true" : "false");
+    for (size_t i = 0; i < scripts.size(); i++) {
+        SourceFile source;
+        if (!source.open(scripts[i])) {
+            cerr << "Error: Unable to open file " << scripts[i] << endl;
+            failures++;
+            continue;
+        }
+        double times[2][2];
+        try {
+            for (int tree_mode = 0; tree_mode < 2; tree_mode++) {
+                for (int quicken = 0; quicken < 2; quicken++) {
+                    times[tree_mode][quicken] = time_runs(source, tree_mode, quicken, optimize, repeat);
+                    totals[tree_mode][quicken] += times[tree_mode][quicken];
+                }
+            }
+        } catch (const exception& error) {
+            cerr << scripts[i] << ": " << error.what() << endl;
+            failures++;
+            continue;
+        }
+        printf("%s    {\"script\": \"%s\", ", measured++ == 0 ? "" : ",\n", scripts[i].c_str());
+        print_backend("tree", times[1][0], times[1][1], false);
+        print_backend("vm", times[0][0], times[0][1], true);
+        printf("}");
+    }
+    output().redirect(stdout);
+    fclose(null_output);
+
+    printf("%s  ],\n  \"total\": {", measured == 0 ? "" : "\n");
+    print_backend("tree", totals[1][0], totals[1][1], false);
+    print_backend("vm", totals[0][0], totals[0][1], true);
+    printf("}\n}\n");
+    if (measured == 0) cerr << "Error: No script could be run" << endl;
+    return failures == 0 && measured > 0 ? 0 : 1;
+}
@@ -1,4 +1,8 @@
 clear
-g++ -std=c++11 src/*.cpp -o mypython.exe
+g++ -std=c++11 -O2 -pthread src/*.cpp -o mypython.exe
+g++ -std=c++11 -O2 -pthread bench/benchmark.cpp -o benchmark.exe
+g++ -std=c++11 -O2 -pthread bench/output_benchmark.cpp -o output_benchmark.exe
+g++ -std=c++11 -O2 -pthread bench/quicken_benchmark.cpp -o quicken_benchmark.exe
+g++ -std=c++11 -O2 client/mypython_client.cpp -o mypython_client.exe
 #mypython.exe 
-#rm mypython.exe
\ No newline at end of file
+#rm mypython.exe
@@ -0,0 +1,82 @@
+/* Drop-in replacement for mypython.exe that hands the script to a resident `mypython.exe --serve`, so it skips
+   process startup and, for a script the server has run before, scanning and parsing. Output, errors and
+   the exit status are the script's own. Options the server does not support are reported as errors.
+
+   Build: g++ -std=c++11 -O2 client/mypython_client.cpp -o mypython_client.exe
+   Usage: ./mypython_client.exe [--socket PATH] [mypython.exe options] <file_path | ->
+   A path of - sends the script from standard input. The socket is $MYPYTHON_SOCKET when that is set,
+   /tmp/mypython.sock otherwise */
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "../src/protocol.cpp"
+
+using namespace std;
+
+/* Options of mypython.exe that take a value, which must not be mistaken for the script */
+static bool takes_value(const string& arg) {
+    return arg == "--recursion-limit" || arg == "--cache-dir" || arg == "--profile" || arg == "--batch" || arg == "--jobs" || arg == "--lex-jobs";
+}
+
+int main(int argc, char* argv[]) {
+    const char* environment_socket = getenv("MYPYTHON_SOCKET");
+    string socket_path = environment_socket != nullptr ? environment_socket : DEFAULT_SOCKET_PATH;
+    vector<string> args;
+    string script;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (takes_value(arg) && i + 1 < argc) {
+            args.push_back(arg);
+            args.push_back(argv[++i]);
+        } else if (script.empty() && (arg == "-" || arg[0] != '-')) script = arg;
+        else args.push_back(arg);
+    }
+    if (script.empty()) {
+        cerr << "Usage: " << argv[0] << " [--socket PATH] [mypython.exe options] <file_path | ->" << endl;
+        return 1;
+    }
+
+    sockaddr_un address;
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!socket_address(socket_path, address) || server < 0
+        || connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        cerr << "Error: Unable to connect to " << socket_path << " (start a server with mypython.exe --serve "
+             << socket_path << ")" << endl;
+        return 1;
+    }
+
+    bool sent = true;
+    for (const string& arg : args) sent = sent && send_frame(server, FRAME_ARG, arg);
+    if (script == "-") {
+        string source(istreambuf_iterator<char>(cin), (istreambuf_iterator<char>()));
+        sent = sent && send_frame(server, FRAME_SOURCE, source);
+    } else {
+        /* The server has its own working directory, so relative paths are resolved here */
+        char resolved[PATH_MAX];
+        sent = sent && send_frame(server, FRAME_PATH, realpath(script.c_str(), resolved) != nullptr ? resolved : script);
+    }
+    sent = sent && send_frame(server, FRAME_RUN, "", 0);
+
+    char kind;
+    string payload;
+    while (sent && receive_frame(server, kind, payload)) {
+        if (kind == FRAME_OUTPUT) {
+            fwrite(payload.data(), 1, payload.size(), stdout);
+        } else if (kind == FRAME_ERROR) {
+            fflush(stdout);
+            fwrite(payload.data(), 1, payload.size(), stderr);
+        } else if (kind == FRAME_EXIT) {
+            close(server);
+            return atoi(payload.c_str());
+        }
+    }
+    fflush(stdout);
+    cerr << "Error: Lost connection to " << socket_path << endl;
+    return 1;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Compiles a script ahead of time: mypython.exe writes it as C++ and g++ builds that into a native program.
+# Usage: ./compile.sh script.py [output] [mypython.exe options]
+# The program is written next to the script, without .py, unless output is given. CXX and CXXFLAGS
+# override the compiler and its flags
+set -e
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 script.py [output] [--no-optimize] [--recursion-limit N]" >&2
+    exit 1
+fi
+root=$(cd "$(dirname "$0")" && pwd)
+script=$1
+shift
+output=${script%.py}
+if [ $# -gt 0 ] && [ "${1#-}" = "$1" ]; then
+    output=$1
+    shift
+fi
+source_file="$output.cpp"
+"$root/mypython.exe" "$@" --emit-cpp "$source_file" "$script"
+${CXX:-g++} -std=c++11 ${CXXFLAGS:--O2} -pthread -I "$root/native" "$source_file" -o "$output"
+rm -f "$source_file"
@@ -0,0 +1,282 @@
+#ifndef RUNTIME_CPP
+#define RUNTIME_CPP
+
+/* Support code for the C++ that `mypython.exe --emit-cpp` writes. A transpiled program includes this file,
+   which brings in the interpreter's own Value, BigInt, operator and output code, so the compiled program
+   computes and prints exactly as the VM does. compile.sh puts this directory on the include path */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../src/bigint.cpp"
+#include "../src/operations.cpp"
+#include "../src/output.cpp"
+#include "../src/scope.cpp"
+#include "../src/token.cpp"
+#include "../src/value.cpp"
+
+#include <pthread.h>
+
+using namespace std;
+
+/* What a Closure calls. The interpreter's FunctionNode is a tree node; a compiled function is only its name,
+   its arity and the C++ function its body became, which takes the frame it was defined in and the arguments */
+class FunctionNode {
+  public:
+    const char* name;
+    int parameters;
+    Value (*code)(Scope* env, Value* arguments);
+    int get_num_parameters() const { return parameters; }
+};
+
+/* Values evaluated left to right, as the elements of a braced list are, whatever order the C++ compiler
+   evaluates function arguments in. Calls, prints and operators whose operands both have effects take one */
+template <size_t N>
+struct Values {
+    Value items[N];
+};
+
+/* Calls made by the program that have not returned yet, and the most allowed */
+static size_t call_depth = 0;
+static size_t recursion_limit = 10000;
+/* A tail call the function returning now has asked for: call_function() makes it once the frame is gone */
+static bool tail_call_pending = false;
+static Value tail_callee;
+static vector<Value> tail_arguments;
+
+/* The module frame, which module-level functions close over. Module variables are C++ variables of
+   their own, so it has no slots */
+static Scope* const module_frame = new Scope(nullptr, 0, nullptr);
+
+/* Reads a variable that may not have been assigned yet */
+inline const Value& load(const Value& value, const char* name) {
+    if (value.is_unbound()) throw runtime_error(string("NameError: \"") + name + "\"");
+    return value;
+}
+
+inline bool condition(bool value) {
+    return value;
+}
+
+inline bool condition(const Value& value) {
+    if (value.type != Value::BOOL) throw runtime_error("Invalid condition type");
+    return value.boolean;
+}
+
+inline bool condition(int64_t) {
+    throw runtime_error("Invalid condition type");
+}
+
+/* An operand of `and` or `or` */
+inline bool operand_bool(bool value) {
+    return value;
+}
+
+inline bool operand_bool(const Value& value) {
+    return short_circuit_result(value).boolean;
+}
+
+inline bool operand_bool(int64_t) {
+    throw runtime_error("Invalid operand type");
+}
+
+/* Arithmetic on two machine integers, which leaves the machine word when it overflows */
+template <Token::TokenType op>
+inline Value int_binary(int64_t a, int64_t b) {
+    int64_t result;
+    switch (op) {
+        case Token::PLUS:
+            if (!add_overflows(a, b, &result)) return Value::make_int(result);
+            break;
+        case Token::MINUS:
+            if (!subtract_overflows(a, b, &result)) return Value::make_int(result);
+            break;
+        case Token::TIMES:
+            if (!multiply_overflows(a, b, &result)) return Value::make_int(result);
+            break;
+        case Token::DIVIDE:
+            if (b != 0 && b != -1) return Value::make_int(a / b);
+            break;
+        default:
+            break;
+    }
+    Value left = Value::make_int(a), right = Value::make_int(b);
+    return compute_IntOp(left, op, &right);
+}
+
+template <Token::TokenType op>
+inline bool int_compare(int64_t a, int64_t b) {
+    switch (op) {
+        case Token::EQUALS:              return a == b;
+        case Token::NOT_EQUALS:          return a != b;
+        case Token::LESS_THAN:           return a <  b;
+        case Token::GREATER_THAN:        return a >  b;
+        case Token::LESS_THAN_EQUALS:    return a <= b;
+        default:                         return a >= b;
+    }
+}
+
+/* Arithmetic operators, with machine integers computed on directly */
+template <Token::TokenType op>
+inline Value binary(const Value& a, const Value& b) {
+    if (a.type == Value::INT && b.type == Value::INT) return int_binary<op>(a.integer, b.integer);
+    return compute_BinaryOp(a, op, b);
+}
+
+template <Token::TokenType op>
+inline Value binary(const Value& a, int64_t b) {
+    if (a.type == Value::INT) return int_binary<op>(a.integer, b);
+    return compute_BinaryOp(a, op, Value::make_int(b));
+}
+
+template <Token::TokenType op>
+inline Value binary(int64_t a, const Value& b) {
+    if (b.type == Value::INT) return int_binary<op>(a, b.integer);
+    return compute_BinaryOp(Value::make_int(a), op, b);
+}
+
+template <Token::TokenType op>
+inline Value binary(Values<2>&& operands) {
+    return binary<op>(operands.items[0], operands.items[1]);
+}
+
+/* Comparison operators, which always give a boolean */
+template <Token::TokenType op>
+inline bool compare(const Value& a, const Value& b) {
+    if (a.type == Value::INT && b.type == Value::INT) return int_compare<op>(a.integer, b.integer);
+    return compute_BinaryOp(a, op, b).boolean;
+}
+
+template <Token::TokenType op>
+inline bool compare(const Value& a, int64_t b) {
+    if (a.type == Value::INT) return int_compare<op>(a.integer, b);
+    return compute_BinaryOp(a, op, Value::make_int(b)).boolean;
+}
+
+template <Token::TokenType op>
+inline bool compare(int64_t a, const Value& b) {
+    if (b.type == Value::INT) return int_compare<op>(a, b.integer);
+    return compute_BinaryOp(Value::make_int(a), op, b).boolean;
+}
+
+template <Token::TokenType op>
+inline bool compare(Values<2>&& operands) {
+    return compare<op>(operands.items[0], operands.items[1]);
+}
+
+inline Value negate(int64_t value) {
+    if (value != INT64_MIN) return Value::make_int(-value);
+    return compute_IntOp(Value::make_int(value), Token::MINUS);
+}
+
+inline int64_t range_bound(int64_t value) {
+    return value;
+}
+
+inline int64_t range_step(int64_t value) {
+    if (value == 0) throw runtime_error("ValueError: range() arg 3 must not be zero");
+    return value;
+}
+
+/* An integer literal too large for a machine word */
+inline Value big_constant(const char* digits, bool negative) {
+    BigInt magnitude = BigInt::from_decimal(digits, strlen(digits));
+    return integer_result(negative ? BigInt::subtract(BigInt::from_int64(0), magnitude) : move(magnitude));
+}
+
+template <size_t N>
+inline Value print_values(Values<N>&& values) {
+    output().print(values.items, N);
+    return Value();
+}
+
+inline Value print_values() {
+    output().print(nullptr, 0);
+    return Value();
+}
+
+/* Calls the function in arguments[0] with the count values after it, checking what the VM's CALL checks in
+   the same order. Tail calls the callee asks for run here, in a loop, after its frame is gone */
+inline Value call_function(Value* arguments, size_t count) {
+    if (call_depth >= recursion_limit) throw runtime_error("RecursionError: maximum recursion depth exceeded");
+    const Value& callee = arguments[0];
+    if (callee.type != Value::FUNCTION) throw runtime_error("Invalid function");
+    if (callee.closure->function->parameters != (int) count) throw runtime_error("Invalid number of parameters");
+    call_depth++;
+    struct Leave {
+        ~Leave() { call_depth--; }
+    } leave;
+    Value result = callee.closure->function->code(callee.closure->env, arguments + 1);
+    if (!tail_call_pending) return result;
+    Value function;
+    vector<Value> pending;
+    while (tail_call_pending) {
+        tail_call_pending = false;
+        function = move(tail_callee);
+        pending.swap(tail_arguments);
+        tail_arguments.clear();
+        result = function.closure->function->code(function.closure->env, pending.data());
+    }
+    return result;
+}
+
+template <size_t N>
+inline Value call(Values<N>&& arguments) {
+    return call_function(arguments.items, N - 1);
+}
+
+/* `return f(...)` in a function. Unless the callee was defined in the returning function's own frame, which
+   must then outlive the call, the call is left to the caller's call_function() and the frame is dropped
+   first, so tail recursion runs in constant space. Frames without nested functions pass nullptr */
+template <size_t N>
+inline Value tail_call(Scope* frame, Values<N>&& arguments) {
+    const Value& callee = arguments.items[0];
+    if (callee.type != Value::FUNCTION || callee.closure->env == frame) return call_function(arguments.items, N - 1);
+    if (callee.closure->function->parameters != (int) N - 1) throw runtime_error("Invalid number of parameters");
+    tail_callee = move(arguments.items[0]);
+    tail_arguments.clear();
+    for (size_t i = 1; i < N; i++) tail_arguments.push_back(move(arguments.items[i]));
+    tail_call_pending = true;
+    return Value();
+}
+
+/* Runs the program on a thread with room for the recursion limit, since compiled calls recurse natively.
+   An error stops the program with the message on stderr after the output so far, as mypython.exe does */
+struct CompiledProgram {
+    void (*module)();
+    int status;
+};
+
+inline void* run_compiled_thread(void* argument) {
+    CompiledProgram* program = static_cast<CompiledProgram*>(argument);
+    try {
+        program->module();
+        output().flush();
+    } catch (const exception& error) {
+        output().flush();
+        cerr << error.what() << endl;
+        program->status = 1;
+    }
+    return nullptr;
+}
+
+inline int run_compiled(void (*module)(), size_t limit) {
+    recursion_limit = limit;
+    CompiledProgram program = {module, 0};
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, ((size_t) 64 << 20) + limit * (8 << 10));
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, &run_compiled_thread, &program) != 0) run_compiled_thread(&program);
+    else pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attributes);
+    return program.status;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef ARENA_CPP
+#define ARENA_CPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#include "ast.cpp"
+
+using namespace std;
+
+/* Bump-pointer allocator for AST nodes. Everything it hands out is released together when it is destroyed */
+class Arena {
+  private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+    vector<char*> blocks;
+    vector<AST*> nodes;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t bytes_used = 0;
+    size_t bytes_reserved = 0;
+
+    void* allocate(size_t size, size_t align) {
+        size_t padding = (align - (reinterpret_cast<size_t>(cursor) & (align - 1))) & (align - 1);
+        if (cursor == nullptr || cursor + padding + size > limit) {
+            size_t block_size = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+            char* block = static_cast<char*>(malloc(block_size));
+            if (block == nullptr) throw bad_alloc();
+            blocks.push_back(block);
+            bytes_reserved += block_size;
+            cursor = block;
+            limit = block + block_size;
+            padding = (align - (reinterpret_cast<size_t>(cursor) & (align - 1))) & (align - 1);
+        }
+        void* result = cursor + padding;
+        cursor += padding + size;
+        bytes_used += padding + size;
+        return result;
+    }
+
+  public:
+    Arena() {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (size_t i = nodes.size(); i > 0; i--) {
+            nodes[i - 1]->~AST();
+        }
+        for (char* block : blocks) {
+            free(block);
+        }
+    }
+
+    /* Destroys every node and frees every block but the first, which is kept for reuse */
+    void clear() {
+        for (size_t i = nodes.size(); i > 0; i--) {
+            nodes[i - 1]->~AST();
+        }
+        nodes.clear();
+        for (size_t i = 1; i < blocks.size(); i++) {
+            free(blocks[i]);
+        }
+        if (blocks.size() > 1) blocks.resize(1);
+        cursor = blocks.empty() ? nullptr : blocks[0];
+        limit = blocks.empty() ? nullptr : blocks[0] + BLOCK_SIZE;
+        bytes_used = 0;
+        bytes_reserved = blocks.empty() ? 0 : BLOCK_SIZE;
+    }
+
+    /* Hands every node and block over to keeper, which then releases them, and leaves this arena empty */
+    void move_into(Arena& keeper) {
+        keeper.nodes.insert(keeper.nodes.end(), nodes.begin(), nodes.end());
+        keeper.blocks.insert(keeper.blocks.end(), blocks.begin(), blocks.end());
+        keeper.bytes_used += bytes_used;
+        keeper.bytes_reserved += bytes_reserved;
+        nodes.clear();
+        blocks.clear();
+        cursor = limit = nullptr;
+        bytes_used = bytes_reserved = 0;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* node = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+        nodes.push_back(node);
+        return node;
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t used() const { return bytes_used; }
+    size_t reserved() const { return bytes_reserved; }
+    size_t block_count() const { return blocks.size(); }
+};
+
+#endif
@@ -3,9 +3,20 @@
 
 #include <vector>
 #include "token.cpp"
+#include "value.cpp"
+
+struct Closure;
+struct CodeObject;
+class MemoTable;
+
+/* Depth of a resolved name that lives in the module frame */
+const int GLOBAL_DEPTH = -1;
 
 class AST {
   public:
+    /* 1-based position of the token the node starts at, 0 for nodes with no source of their own */
+    int line = 0;
+    int column = 0;
     virtual ~AST() {}
 };
 
@@ -17,18 +28,37 @@ class BlockNode : public AST {
 
 class FunctionNode : public AST {
   public:
-    string id;
+    Symbol id;
     BlockNode* function_body = nullptr;
-    vector<string> parameters;
-    FunctionNode(string name) : id(name) {}
+    vector<Symbol> parameters;
+    vector<Symbol> locals;
+    int depth = 0;
+    int slot = -1;
+    CodeObject* code = nullptr;
+    MemoTable* memo = nullptr;
+    /* A body the Parser only skimmed: its source runs from lazy_begin, the start of its first line, to
+       lazy_end, and it is parsed on the first call. function_body stays nullptr until then */
+    const char* lazy_begin = nullptr;
+    const char* lazy_end = nullptr;
+    int lazy_line = 0;
+    int lazy_indent = 0;
+    /* The function this one is defined in, nullptr at module level; set by the Resolver */
+    FunctionNode* enclosing = nullptr;
+    FunctionNode(Symbol name) : id(name) {}
     int get_num_parameters() { return parameters.size(); }
 };
 
 class FunctionCallNode : public AST {
   public:
-    string id;
+    Symbol id;
     vector<AST*> parameters;
-    FunctionCallNode(string name) : id(name) {}
+    int depth = 0;
+    int slot = -1;
+    /* Inline cache of the walker: the closure this call resolved to, already checked to be a function
+       taking this many arguments, valid while the interpreter's binding version is cached_version */
+    Closure* cached_target = nullptr;
+    unsigned long cached_version = 0;
+    FunctionCallNode(Symbol name) : id(name) {}
     int get_num_parameters() { return parameters.size(); }
 };
 
@@ -38,19 +68,29 @@ class ReturnNode : public AST {
     ReturnNode(AST* v) : value(v) {}
 };
 
+/* An if with its elif branches: conditions[i] guards bodies[i], they are tried in order, and else_body
+   runs when none holds. A plain if has one branch */
 class ConditionalNode : public AST {
   public:
-    AST* condition;
-    AST* if_body;
-    AST* else_body;
-
-    ConditionalNode(AST* condition, AST* if_body, AST* else_body) : condition(condition), if_body(if_body), else_body(else_body) {}
+    vector<AST*> conditions;
+    vector<AST*> bodies;
+    AST* else_body = nullptr;
+
+    ConditionalNode() {}
+    ConditionalNode(AST* condition, AST* if_body, AST* else_body) : conditions(1, condition), bodies(1, if_body), else_body(else_body) {}
+    void add_branch(AST* condition, AST* body) {
+        conditions.push_back(condition);
+        bodies.push_back(body);
+    }
 };
 
 class UnaryOpNode : public AST {
   public:
     Token op;
     AST* expr;
+    /* The QuickOp the walker runs this site as, and the OperandKind of expr */
+    unsigned char quick = 0;
+    unsigned char expr_kind = 0;
     UnaryOpNode(Token op, AST* expr) : op(op), expr(expr) {}
 };
 
@@ -59,31 +99,41 @@ class BinaryOpNode : public AST {
     AST* left;
     Token op;
     AST* right;
+    /* The QuickOp the walker runs this site as, and the OperandKind of each side */
+    unsigned char quick = 0;
+    unsigned char left_kind = 0;
+    unsigned char right_kind = 0;
     BinaryOpNode(AST* left, Token op, AST* right) : left(left), op(op), right(right) {}
 };
 
 class StringNode : public AST {
   public:
     string text;
-    StringNode(string t) : text(t) {}
+    Value constant;
+    StringNode(string t) : text(t), constant(Value::make_string(t)) {}
 };
 
 class BoolNode : public AST {
   public:
     bool value;
-    BoolNode(bool v) : value(v) {}
+    Value constant;
+    BoolNode(bool v) : value(v), constant(Value::make_bool(v)) {}
 };
 
+/* An integer literal. constant is an INT, or a BIGINT for a literal too large for a machine word */
 class IntNode : public AST {
   public:
-    int value;
-    IntNode(int v) : value(v) {}
+    Value constant;
+    IntNode(int64_t v) : constant(Value::make_int(v)) {}
+    IntNode(Value v) : constant(move(v)) {}
 };
 
 class VariableNode : public AST {
   public:
-    string id;
-    VariableNode(string name) : id(name) {}
+    Symbol id;
+    int depth = 0;
+    int slot = -1;
+    VariableNode(Symbol name) : id(name) {}
 };
 
 class AssignNode : public AST {
@@ -94,6 +144,26 @@ class AssignNode : public AST {
     AssignNode(VariableNode* left, Token op, AST* right) : left(left), op(op), right(right) {}
 };
 
+class WhileNode : public AST {
+  public:
+    AST* condition;
+    AST* body;
+    WhileNode(AST* condition, AST* body) : condition(condition), body(body) {}
+};
+
+/* for variable in range(start, stop, step). The bounds are evaluated once, before the first iteration, and
+   the loop counts with a machine integer of its own, storing it into variable at the top of each pass */
+class ForRangeNode : public AST {
+  public:
+    VariableNode* variable;
+    AST* start;
+    AST* stop;
+    AST* step;
+    AST* body;
+    ForRangeNode(VariableNode* variable, AST* start, AST* stop, AST* step, AST* body)
+        : variable(variable), start(start), stop(stop), step(step), body(body) {}
+};
+
 class NoOp : public AST {
   public:
     ;
@@ -0,0 +1,252 @@
+#ifndef BATCH_CPP
+#define BATCH_CPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "interpreter.cpp"
+#include "output.cpp"
+#include "parser.cpp"
+#include "scanner.cpp"
+#include "source.cpp"
+#include "stack.cpp"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+/* One script of a batch, with its captured output once a worker has run it */
+struct BatchJob {
+    string script;
+    string expected_path;
+    string output;
+    string error;
+    bool passed = false;
+    bool done = false;
+};
+
+/* Runs many scripts in one process on a pool of worker threads. Each script gets its own Parser,
+   Interpreter and frames, and prints into its own OutputSink, so nothing but the symbol table is shared.
+   Results are reported in input order as they complete: a script with an expected-output file is
+   reported as passed or failed, any other script has its output streamed to stdout */
+class BatchRunner {
+  private:
+    vector<BatchJob> jobs;
+#ifndef _WIN32
+    vector<pthread_t> workers;
+#else
+    vector<thread> workers;
+#endif
+    atomic<size_t> next_job;
+    mutex lock;
+    condition_variable job_done;
+
+    static bool file_exists(const string& path) {
+        ifstream file(path);
+        return file.good();
+    }
+
+    static bool read_file(const string& path, string& text) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        text.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return true;
+    }
+
+    /* name.out next to the script, or outNN.txt for inNN.py as in testcases/ */
+    static string find_expected(const string& script) {
+        size_t slash = script.find_last_of('/');
+        string folder = slash == string::npos ? "" : script.substr(0, slash + 1);
+        string name = slash == string::npos ? script : script.substr(slash + 1);
+        string stem = name.size() > 3 && name.compare(name.size() - 3, 3, ".py") == 0 ? name.substr(0, name.size() - 3) : name;
+        if (file_exists(folder + stem + ".out")) return folder + stem + ".out";
+        if (stem.compare(0, 2, "in") == 0 && file_exists(folder + "out" + stem.substr(2) + ".txt"))
+            return folder + "out" + stem.substr(2) + ".txt";
+        return "";
+    }
+
+    void run_job(BatchJob& job) {
+        SourceFile source;
+        if (!source.open(job.script)) {
+            job.error = "Error: Unable to open file " + job.script;
+            return;
+        }
+        OutputSink sink(&job.output);
+        try {
+            Scanner scanner(source.data(), source.size());
+            Parser parser(scanner);
+            Interpreter interpreter(parser);
+            interpreter.TREE_MODE = TREE_MODE;
+            interpreter.OPTIMIZE = OPTIMIZE;
+            interpreter.MEMOIZE = MEMOIZE;
+            interpreter.RECURSION_LIMIT = RECURSION_LIMIT;
+            interpreter.out = &sink;
+            interpreter.run(interpreter.prepare());
+        } catch (const exception& error) {
+            job.error = error.what();
+        }
+        sink.flush();
+        if (!job.expected_path.empty()) {
+            string expected;
+            job.passed = job.error.empty() && read_file(job.expected_path, expected) && expected == job.output;
+        }
+    }
+
+    void work() {
+        for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            run_job(jobs[i]);
+            lock_guard<mutex> guard(lock);
+            jobs[i].done = true;
+            job_done.notify_all();
+        }
+    }
+
+    static void* start_worker(void* runner) {
+        static_cast<BatchRunner*>(runner)->work();
+        return nullptr;
+    }
+
+    /* Starts count workers with a WORKER_STACK_SIZE stack, as ScriptServer does, since a worker parses and
+       runs whole scripts natively. Returns the workers started: if none could be, the caller runs the jobs */
+    size_t start_workers(size_t count) {
+        size_t started = 0;
+#ifndef _WIN32
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+        workers.resize(count);
+        for (size_t i = 0; i < count; i++)
+            if (pthread_create(&workers[started], &attributes, &BatchRunner::start_worker, this) == 0) started++;
+        pthread_attr_destroy(&attributes);
+        workers.resize(started);
+#else
+        for (; started < count; started++) workers.emplace_back(&BatchRunner::work, this);
+#endif
+        return started;
+    }
+
+    void join_workers() {
+#ifndef _WIN32
+        for (pthread_t& worker : workers) pthread_join(worker, nullptr);
+#else
+        for (thread& worker : workers) worker.join();
+#endif
+        workers.clear();
+    }
+
+  public:
+    bool TREE_MODE = false;
+    bool OPTIMIZE = true;
+    bool MEMOIZE = false;
+    size_t RECURSION_LIMIT = DEFAULT_RECURSION_LIMIT;
+    size_t JOBS = max(1u, thread::hardware_concurrency());
+
+    BatchRunner() : next_job(0) {}
+    BatchRunner(const BatchRunner&) = delete;
+
+    void add(const string& script, const string& expected_path) {
+        BatchJob job;
+        job.script = script;
+        job.expected_path = expected_path;
+        jobs.push_back(move(job));
+    }
+
+    /* A manifest lists one script per line, optionally followed by its expected-output file.
+       Blank lines and lines starting with # are skipped */
+    bool add_manifest(const string& path) {
+        ifstream manifest(path);
+        if (!manifest.is_open()) return false;
+        string line;
+        while (getline(manifest, line)) {
+            istringstream fields(line);
+            string script, expected;
+            if (!(fields >> script) || script[0] == '#') continue;
+            if (!(fields >> expected)) expected = find_expected(script);
+            add(script, expected);
+        }
+        return true;
+    }
+
+    /* Every .py file in directory, in name order */
+    bool add_directory(const string& path) {
+#ifndef _WIN32
+        DIR* directory = opendir(path.c_str());
+        if (directory == nullptr) return false;
+        vector<string> names;
+        while (dirent* entry = readdir(directory)) {
+            string name = entry->d_name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, ".py") == 0) names.push_back(name);
+        }
+        closedir(directory);
+        sort(names.begin(), names.end());
+        string folder = path.back() == '/' ? path : path + "/";
+        for (const string& name : names) add(folder + name, find_expected(folder + name));
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* A directory of scripts, or a manifest file */
+    bool add_path(const string& path) {
+#ifndef _WIN32
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) return add_directory(path);
+#endif
+        return add_manifest(path);
+    }
+
+    /* Runs every job and reports each one in order as soon as it and those before it are done.
+       Returns the process exit code: 0 when every script ran without error and matched its expected output */
+    int run() {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        size_t count = start_workers(min(JOBS, jobs.size()));
+        if (count == 0 && !jobs.empty()) {
+            work();
+            count = 1;
+        }
+
+        int passed = 0, failed = 0, errors = 0;
+        for (BatchJob& job : jobs) {
+            {
+                unique_lock<mutex> guard(lock);
+                job_done.wait(guard, [&job] { return job.done; });
+            }
+            if (!job.expected_path.empty()) {
+                job.passed ? passed++ : failed++;
+                cout << (job.passed ? "PASS " : "FAIL ") << job.script;
+                if (!job.error.empty()) cout << " (" << job.error << ")";
+                cout << endl;
+            } else {
+                cout.write(job.output.data(), job.output.size());
+                if (!job.error.empty()) {
+                    errors++;
+                    cout.flush();
+                    cerr << job.script << ": " << job.error << endl;
+                }
+            }
+            string().swap(job.output);
+        }
+        join_workers();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << "batch: " << jobs.size() << " scripts, " << passed << " passed, " << failed << " failed, "
+             << errors << " errors in " << seconds << "s on " << count << " threads" << endl;
+        return failed == 0 && errors == 0 ? 0 : 1;
+    }
+};
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef BIGINT_CPP
+#define BIGINT_CPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/* Limbs are machine words wherever the compiler has a double-width type to multiply them in */
+#if defined(__SIZEOF_INT128__)
+typedef uint64_t Limb;
+typedef unsigned __int128 DoubleLimb;
+#else
+typedef uint32_t Limb;
+typedef uint64_t DoubleLimb;
+#endif
+
+/* Arbitrary-precision integer, for the values an int64_t cannot hold. Sign and magnitude, the magnitude
+   in little-endian limbs with no leading zero limb. Values share one by reference count like strings,
+   and never change it, so the operations build a new BigInt */
+struct BigInt {
+    static const int LIMB_BITS = sizeof(Limb) * 8;
+    /* Operands at least this many limbs long are multiplied with Karatsuba's method */
+    static const size_t KARATSUBA_THRESHOLD = 32;
+
+    int refs = 1;
+    bool negative = false;
+    vector<Limb> limbs;
+
+    BigInt() {}
+    BigInt(bool negative, vector<Limb> magnitude) : negative(negative), limbs(move(magnitude)) {
+        trim(limbs);
+        if (limbs.empty()) this->negative = false;
+    }
+
+    static BigInt from_int64(int64_t value) {
+        uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+        vector<Limb> limbs;
+        while (magnitude != 0) {
+            limbs.push_back((Limb) magnitude);
+            /* In two steps, since shifting a 64-bit value by 64 is undefined */
+            magnitude = magnitude >> (LIMB_BITS - 1) >> 1;
+        }
+        return BigInt(value < 0, move(limbs));
+    }
+
+    /* Parses an optional '-' and decimal digits, taking a chunk of digits per multiply-add */
+    static BigInt from_decimal(const char* digits, size_t length) {
+        bool negative = length > 0 && digits[0] == '-';
+        size_t i = negative ? 1 : 0;
+        vector<Limb> magnitude;
+        while (i < length) {
+            size_t count = min(length - i, (size_t) DECIMAL_CHUNK_DIGITS);
+            Limb chunk = 0, scale = 1;
+            for (size_t end = i + count; i < end; i++) {
+                chunk = chunk * 10 + (digits[i] - '0');
+                scale *= 10;
+            }
+            multiply_add_small(magnitude, scale, chunk);
+        }
+        return BigInt(negative, move(magnitude));
+    }
+
+    bool fits_int64() const {
+        if (limbs.size() > 64 / LIMB_BITS) return false;
+        uint64_t magnitude = low_bits();
+        return negative ? magnitude <= (uint64_t) 1 << 63 : magnitude < (uint64_t) 1 << 63;
+    }
+
+    /* Only meaningful when fits_int64() */
+    int64_t to_int64() const {
+        uint64_t magnitude = low_bits();
+        return negative ? (int64_t) (0 - magnitude) : (int64_t) magnitude;
+    }
+
+    /* Writes the decimal digits, a chunk of them per pass of a one-limb division */
+    string to_decimal() const {
+        if (limbs.empty()) return "0";
+        vector<Limb> rest = limbs;
+        vector<Limb> chunks;
+        while (!rest.empty()) chunks.push_back(divide_small(rest, DECIMAL_CHUNK));
+        string text = negative ? "-" : "";
+        text += to_string((unsigned long long) chunks.back());
+        for (size_t i = chunks.size() - 1; i-- > 0;) {
+            string chunk = to_string((unsigned long long) chunks[i]);
+            text.append(DECIMAL_CHUNK_DIGITS - chunk.size(), '0');
+            text += chunk;
+        }
+        return text;
+    }
+
+    size_t hash() const {
+        size_t h = negative;
+        for (Limb limb : limbs) h = h * 31 + std::hash<uint64_t>()(limb);
+        return h;
+    }
+
+    static int compare(const BigInt& a, const BigInt& b) {
+        if (a.negative != b.negative) return a.negative ? -1 : 1;
+        int order = compare_magnitudes(a.limbs, b.limbs);
+        return a.negative ? -order : order;
+    }
+
+    static BigInt add(const BigInt& a, const BigInt& b) {
+        if (a.negative == b.negative) return BigInt(a.negative, add_magnitudes(a.limbs, b.limbs));
+        if (compare_magnitudes(a.limbs, b.limbs) >= 0) return BigInt(a.negative, subtract_magnitudes(a.limbs, b.limbs));
+        return BigInt(b.negative, subtract_magnitudes(b.limbs, a.limbs));
+    }
+
+    static BigInt subtract(const BigInt& a, const BigInt& b) {
+        BigInt negated(!b.negative, b.limbs);
+        return add(a, negated);
+    }
+
+    static BigInt multiply(const BigInt& a, const BigInt& b) {
+        return BigInt(a.negative != b.negative, multiply_magnitudes(a.limbs, b.limbs));
+    }
+
+    /* Truncates toward zero, like the int64_t division it extends. The divisor must not be zero */
+    static BigInt divide(const BigInt& a, const BigInt& b) {
+        return BigInt(a.negative != b.negative, divide_magnitudes(a.limbs, b.limbs));
+    }
+
+  private:
+#if defined(__SIZEOF_INT128__)
+    static const int DECIMAL_CHUNK_DIGITS = 19;
+    static const Limb DECIMAL_CHUNK = 10000000000000000000ull;
+#else
+    static const int DECIMAL_CHUNK_DIGITS = 9;
+    static const Limb DECIMAL_CHUNK = 1000000000u;
+#endif
+
+    uint64_t low_bits() const {
+        uint64_t bits = 0;
+        for (size_t i = min(limbs.size(), (size_t) (64 / LIMB_BITS)); i-- > 0;) {
+            bits = bits << (LIMB_BITS - 1) << 1 | limbs[i];
+        }
+        return bits;
+    }
+
+    static void trim(vector<Limb>& magnitude) {
+        while (!magnitude.empty() && magnitude.back() == 0) magnitude.pop_back();
+    }
+
+    static int compare_magnitudes(const vector<Limb>& a, const vector<Limb>& b) {
+        if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+        for (size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    static vector<Limb> add_magnitudes(const vector<Limb>& a, const vector<Limb>& b) {
+        const vector<Limb>& longer = a.size() >= b.size() ? a : b;
+        const vector<Limb>& shorter = a.size() >= b.size() ? b : a;
+        vector<Limb> sum(longer.size() + 1);
+        Limb carry = 0;
+        for (size_t i = 0; i < longer.size(); i++) {
+            DoubleLimb total = (DoubleLimb) longer[i] + (i < shorter.size() ? shorter[i] : 0) + carry;
+            sum[i] = (Limb) total;
+            carry = (Limb) (total >> LIMB_BITS);
+        }
+        sum[longer.size()] = carry;
+        trim(sum);
+        return sum;
+    }
+
+    /* a - b, where a >= b */
+    static vector<Limb> subtract_magnitudes(const vector<Limb>& a, const vector<Limb>& b) {
+        vector<Limb> difference(a);
+        subtract_at(difference, b.data(), b.size(), 0);
+        trim(difference);
+        return difference;
+    }
+
+    /* target -= value shifted left by offset limbs. target must be at least as large */
+    static void subtract_at(vector<Limb>& target, const Limb* value, size_t length, size_t offset) {
+        Limb borrow = 0;
+        for (size_t i = 0; i < length || borrow != 0; i++) {
+            DoubleLimb difference = (DoubleLimb) target[offset + i] - (i < length ? value[i] : 0) - borrow;
+            target[offset + i] = (Limb) difference;
+            borrow = (Limb) (difference >> LIMB_BITS) != 0;
+        }
+    }
+
+    /* target += value shifted left by offset limbs. target must be large enough for the sum */
+    static void add_at(vector<Limb>& target, const Limb* value, size_t length, size_t offset) {
+        Limb carry = 0;
+        for (size_t i = 0; i < length || carry != 0; i++) {
+            DoubleLimb total = (DoubleLimb) target[offset + i] + (i < length ? value[i] : 0) + carry;
+            target[offset + i] = (Limb) total;
+            carry = (Limb) (total >> LIMB_BITS);
+        }
+    }
+
+    static void multiply_add_small(vector<Limb>& magnitude, Limb factor, Limb addend) {
+        Limb carry = addend;
+        for (Limb& limb : magnitude) {
+            DoubleLimb product = (DoubleLimb) limb * factor + carry;
+            limb = (Limb) product;
+            carry = (Limb) (product >> LIMB_BITS);
+        }
+        if (carry != 0) magnitude.push_back(carry);
+    }
+
+    /* Divides in place by a single limb and returns the remainder */
+    static Limb divide_small(vector<Limb>& magnitude, Limb divisor) {
+        DoubleLimb remainder = 0;
+        for (size_t i = magnitude.size(); i-- > 0;) {
+            DoubleLimb current = (remainder << LIMB_BITS) | magnitude[i];
+            magnitude[i] = (Limb) (current / divisor);
+            remainder = current % divisor;
+        }
+        trim(magnitude);
+        return (Limb) remainder;
+    }
+
+    static void multiply_schoolbook(const Limb* a, size_t a_length, const Limb* b, size_t b_length, Limb* product) {
+        for (size_t i = 0; i < a_length; i++) {
+            Limb carry = 0;
+            for (size_t j = 0; j < b_length; j++) {
+                DoubleLimb partial = (DoubleLimb) a[i] * b[j] + product[i + j] + carry;
+                product[i + j] = (Limb) partial;
+                carry = (Limb) (partial >> LIMB_BITS);
+            }
+            product[i + b_length] = carry;
+        }
+    }
+
+    /* product must hold a_length + b_length zeroed limbs, and a_length >= b_length */
+    static void multiply_into(const Limb* a, size_t a_length, const Limb* b, size_t b_length, vector<Limb>& product, size_t offset) {
+        if (b_length < KARATSUBA_THRESHOLD) {
+            vector<Limb> partial(a_length + b_length);
+            multiply_schoolbook(a, a_length, b, b_length, partial.data());
+            add_at(product, partial.data(), partial.size(), offset);
+            return;
+        }
+        /* An operand much shorter than the other is multiplied with it a slice at a time */
+        if (b_length * 2 <= a_length) {
+            for (size_t start = 0; start < a_length; start += b_length) {
+                size_t length = min(b_length, a_length - start);
+                if (length >= b_length) multiply_into(a + start, length, b, b_length, product, offset + start);
+                else multiply_into(b, b_length, a + start, length, product, offset + start);
+            }
+            return;
+        }
+        /* (a1 x + a0)(b1 x + b0) = a1 b1 x^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) x + a0 b0, with x = 2^(half * LIMB_BITS) */
+        size_t half = a_length / 2;
+        vector<Limb> a0(a, a + half), a1(a + half, a + a_length);
+        vector<Limb> b0(b, b + half), b1(b + half, b + b_length);
+        trim(a0);
+        trim(b0);
+        vector<Limb> low = multiply_magnitudes(a0, b0);
+        vector<Limb> high = multiply_magnitudes(a1, b1);
+        vector<Limb> middle = multiply_magnitudes(add_magnitudes(a0, a1), add_magnitudes(b0, b1));
+        middle.resize(max(middle.size(), max(low.size(), high.size())) + 1);
+        subtract_at(middle, low.data(), low.size(), 0);
+        subtract_at(middle, high.data(), high.size(), 0);
+        trim(middle);
+        add_at(product, low.data(), low.size(), offset);
+        add_at(product, middle.data(), middle.size(), offset + half);
+        add_at(product, high.data(), high.size(), offset + 2 * half);
+    }
+
+    static vector<Limb> multiply_magnitudes(const vector<Limb>& a, const vector<Limb>& b) {
+        if (a.empty() || b.empty()) return vector<Limb>();
+        vector<Limb> product(a.size() + b.size() + 1);
+        if (a.size() >= b.size()) multiply_into(a.data(), a.size(), b.data(), b.size(), product, 0);
+        else multiply_into(b.data(), b.size(), a.data(), a.size(), product, 0);
+        trim(product);
+        return product;
+    }
+
+    static int leading_zeros(Limb limb) {
+        int count = 0;
+        for (Limb bit = (Limb) 1 << (LIMB_BITS - 1); (limb & bit) == 0; bit >>= 1) count++;
+        return count;
+    }
+
+    /* Quotient of long division, Knuth's algorithm D. The divisor must not be zero */
+    static vector<Limb> divide_magnitudes(const vector<Limb>& dividend, const vector<Limb>& divisor) {
+        if (compare_magnitudes(dividend, divisor) < 0) return vector<Limb>();
+        if (divisor.size() == 1) {
+            vector<Limb> quotient(dividend);
+            divide_small(quotient, divisor[0]);
+            return quotient;
+        }
+        /* Shift both so the divisor's top limb has its high bit set, which keeps each estimated
+           quotient limb at most two too large */
+        size_t n = divisor.size(), m = dividend.size() - n;
+        int shift = leading_zeros(divisor.back());
+        vector<Limb> v(n), u(dividend.size() + 1);
+        for (size_t i = n; i-- > 0;) {
+            v[i] = shift == 0 ? divisor[i] : (divisor[i] << shift) | (i > 0 ? divisor[i - 1] >> (LIMB_BITS - shift) : 0);
+        }
+        u[dividend.size()] = shift == 0 ? 0 : dividend.back() >> (LIMB_BITS - shift);
+        for (size_t i = dividend.size(); i-- > 0;) {
+            u[i] = shift == 0 ? dividend[i] : (dividend[i] << shift) | (i > 0 ? dividend[i - 1] >> (LIMB_BITS - shift) : 0);
+        }
+
+        const DoubleLimb base = (DoubleLimb) 1 << LIMB_BITS;
+        vector<Limb> quotient(m + 1);
+        for (size_t j = m + 1; j-- > 0;) {
+            DoubleLimb numerator = ((DoubleLimb) u[j + n] << LIMB_BITS) | u[j + n - 1];
+            DoubleLimb estimate = numerator / v[n - 1];
+            DoubleLimb remainder = numerator % v[n - 1];
+            while (estimate >= base || estimate * v[n - 2] > ((remainder << LIMB_BITS) | u[j + n - 2])) {
+                estimate--;
+                remainder += v[n - 1];
+                if (remainder >= base) break;
+            }
+
+            /* u[j .. j+n] -= estimate * v */
+            Limb borrow = 0, carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                DoubleLimb product = estimate * v[i] + carry;
+                carry = (Limb) (product >> LIMB_BITS);
+                DoubleLimb difference = (DoubleLimb) u[i + j] - (Limb) product - borrow;
+                u[i + j] = (Limb) difference;
+                borrow = (Limb) (difference >> LIMB_BITS) != 0;
+            }
+            DoubleLimb top = (DoubleLimb) u[j + n] - carry - borrow;
+            u[j + n] = (Limb) top;
+
+            /* The estimate was one too large: add the divisor back */
+            if ((Limb) (top >> LIMB_BITS) != 0) {
+                estimate--;
+                Limb add_carry = 0;
+                for (size_t i = 0; i < n; i++) {
+                    DoubleLimb total = (DoubleLimb) u[i + j] + v[i] + add_carry;
+                    u[i + j] = (Limb) total;
+                    add_carry = (Limb) (total >> LIMB_BITS);
+                }
+                u[j + n] += add_carry;
+            }
+            quotient[j] = (Limb) estimate;
+        }
+        trim(quotient);
+        return quotient;
+    }
+};
+
+#endif
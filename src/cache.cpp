@@ -0,0 +1,401 @@
+#ifndef CACHE_CPP
+#define CACHE_CPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "arena.cpp"
+#include "ast.cpp"
+#include "bigint.cpp"
+#include "operations.cpp"
+#include "source.cpp"
+#include "symbol.cpp"
+#include "token.cpp"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* Part of every cache key. Bump it whenever the AST or the way it is serialized changes */
+const char* const INTERPRETER_VERSION = "mypython 1.22";
+
+/* Binary copy of a parsed script, like a .pyc. The file starts with a header holding the key (a hash of
+   the source and the interpreter version) and the source size, then lists the identifier names the tree
+   uses, then the nodes in pre-order. Symbols are renumbered on load, since ids depend on interning order.
+   On later runs the file is memory-mapped and the tree is rebuilt from it without scanning the source.
+
+   The tree is stored exactly as Parser::program() returns it: resolving and optimizing run again on load. */
+class AstCache {
+  private:
+    enum Tag : uint8_t {
+        NULL_TAG, BLOCK, FUNCTION, FUNCTION_CALL, RETURN, CONDITIONAL, UNARY_OP, BINARY_OP,
+        STRING, BOOL, INT, VARIABLE, ASSIGN, NO_OP, BIG_INT, WHILE, FOR_RANGE
+    };
+
+    static const uint32_t MAGIC = 0x4359504d; // "MPYC"
+
+    string path;
+    uint64_t key;
+    uint64_t source_size;
+
+    /* Serializes a tree. Integers are LEB128 varints, so small slots and ids take one byte */
+    class Writer {
+      private:
+        unordered_map<Symbol, uint32_t> local_ids;
+
+      public:
+        string bytes;
+        vector<Symbol> names;
+
+        void put_u8(uint8_t value) { bytes += (char) value; }
+
+        void put_varint(uint64_t value) {
+            while (value >= 0x80) {
+                bytes += (char) (value | 0x80);
+                value >>= 7;
+            }
+            bytes += (char) value;
+        }
+
+        void put_fixed(uint64_t value, int size) {
+            for (int i = 0; i < size; i++) bytes += (char) (value >> (8 * i));
+        }
+
+        void put_string(const string& text) {
+            put_varint(text.size());
+            bytes += text;
+        }
+
+        void put_symbol(Symbol id) {
+            auto found = local_ids.find(id);
+            if (found == local_ids.end()) {
+                found = local_ids.insert({id, (uint32_t) names.size()}).first;
+                names.push_back(id);
+            }
+            put_varint(found->second);
+        }
+
+        /* Every node but a null one starts with its tag, line and column */
+        void put_header(Tag tag, AST* node) {
+            put_u8(tag);
+            put_varint(node->line);
+            put_varint(node->column);
+        }
+
+        void put_node(AST* node_) {
+            if (node_ == nullptr) {
+                put_u8(NULL_TAG);
+                return;
+            }
+            if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+                put_header(BLOCK, node);
+                put_varint(node->children.size());
+                for (AST* child : node->children) put_node(child);
+            } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+                put_header(FUNCTION, node);
+                put_symbol(node->id);
+                put_varint(node->parameters.size());
+                for (Symbol parameter : node->parameters) put_symbol(parameter);
+                put_node(node->function_body);
+            } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+                put_header(FUNCTION_CALL, node);
+                put_symbol(node->id);
+                put_varint(node->parameters.size());
+                for (AST* parameter : node->parameters) put_node(parameter);
+            } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+                put_header(RETURN, node);
+                put_node(node->value);
+            } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+                put_header(CONDITIONAL, node);
+                put_varint(node->conditions.size());
+                for (size_t i = 0; i < node->conditions.size(); i++) {
+                    put_node(node->conditions[i]);
+                    put_node(node->bodies[i]);
+                }
+                put_node(node->else_body);
+            } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+                put_header(WHILE, node);
+                put_node(node->condition);
+                put_node(node->body);
+            } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+                put_header(FOR_RANGE, node);
+                put_node(node->variable);
+                put_node(node->start);
+                put_node(node->stop);
+                put_node(node->step);
+                put_node(node->body);
+            } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+                put_header(UNARY_OP, node);
+                put_u8(node->op.type);
+                put_node(node->expr);
+            } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+                put_header(BINARY_OP, node);
+                put_u8(node->op.type);
+                put_node(node->left);
+                put_node(node->right);
+            } else if (StringNode* node = dynamic_cast<StringNode*>(node_)) {
+                put_header(STRING, node);
+                put_string(node->text);
+            } else if (BoolNode* node = dynamic_cast<BoolNode*>(node_)) {
+                put_header(BOOL, node);
+                put_u8(node->value);
+            } else if (IntNode* node = dynamic_cast<IntNode*>(node_)) {
+                if (node->constant.type == Value::BIGINT) {
+                    put_header(BIG_INT, node);
+                    put_string(node->constant.big->to_decimal());
+                } else {
+                    put_header(INT, node);
+                    put_varint((uint64_t) node->constant.integer);
+                }
+            } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+                put_header(VARIABLE, node);
+                put_symbol(node->id);
+            } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+                put_header(ASSIGN, node);
+                put_u8(node->op.type);
+                put_node(node->left);
+                put_node(node->right);
+            } else if (NoOp* node = dynamic_cast<NoOp*>(node_)) {
+                put_header(NO_OP, node);
+            } else {
+                throw runtime_error("Cannot cache AST node");
+            }
+        }
+    };
+
+    /* Rebuilds a tree from a mapped file. Any inconsistency throws, and the cache entry is ignored */
+    class Reader {
+      private:
+        const char* cursor;
+        const char* end;
+        Arena& arena;
+
+        void need(size_t count) {
+            if ((size_t) (end - cursor) < count) throw runtime_error("Truncated AST cache");
+        }
+
+      public:
+        vector<Symbol> symbols_by_id;
+
+        Reader(const char* bytes, size_t length, Arena& arena) : cursor(bytes), end(bytes + length), arena(arena) {}
+
+        bool at_end() const { return cursor == end; }
+
+        uint8_t get_u8() {
+            need(1);
+            return (uint8_t) *cursor++;
+        }
+
+        uint64_t get_varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                uint8_t byte = get_u8();
+                value |= (uint64_t) (byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return value;
+            }
+            throw runtime_error("Bad varint in AST cache");
+        }
+
+        uint64_t get_fixed(int size) {
+            uint64_t value = 0;
+            for (int i = 0; i < size; i++) value |= (uint64_t) get_u8() << (8 * i);
+            return value;
+        }
+
+        string get_string() {
+            uint64_t length = get_varint();
+            need(length);
+            string text(cursor, length);
+            cursor += length;
+            return text;
+        }
+
+        Symbol get_symbol() {
+            uint64_t id = get_varint();
+            if (id >= symbols_by_id.size()) throw runtime_error("Bad symbol in AST cache");
+            return symbols_by_id[id];
+        }
+
+        Token get_op() {
+            uint8_t type = get_u8();
+            if (type > Token::AND) throw runtime_error("Bad operator in AST cache");
+            return Token((Token::TokenType) type, "", 0);
+        }
+
+        AST* get_node() {
+            uint8_t tag = get_u8();
+            if (tag == NULL_TAG) return nullptr;
+            int line = get_varint();
+            int column = get_varint();
+            AST* node = get_fields(tag);
+            node->line = line;
+            node->column = column;
+            return node;
+        }
+
+        AST* get_fields(uint8_t tag) {
+            switch (tag) {
+                case BLOCK: {
+                    BlockNode* node = arena.make<BlockNode>();
+                    uint64_t count = get_varint();
+                    for (uint64_t i = 0; i < count; i++) node->children.push_back(get_node());
+                    return node;
+                }
+                case FUNCTION: {
+                    FunctionNode* node = arena.make<FunctionNode>(get_symbol());
+                    uint64_t count = get_varint();
+                    for (uint64_t i = 0; i < count; i++) node->parameters.push_back(get_symbol());
+                    node->function_body = dynamic_cast<BlockNode*>(get_node());
+                    if (node->function_body == nullptr) throw runtime_error("Bad function body in AST cache");
+                    return node;
+                }
+                case FUNCTION_CALL: {
+                    FunctionCallNode* node = arena.make<FunctionCallNode>(get_symbol());
+                    uint64_t count = get_varint();
+                    for (uint64_t i = 0; i < count; i++) node->parameters.push_back(get_node());
+                    return node;
+                }
+                case RETURN: return arena.make<ReturnNode>(get_node());
+                case CONDITIONAL: {
+                    ConditionalNode* node = arena.make<ConditionalNode>();
+                    uint64_t count = get_varint();
+                    for (uint64_t i = 0; i < count; i++) {
+                        AST* condition = get_node();
+                        node->add_branch(condition, get_node());
+                    }
+                    node->else_body = get_node();
+                    return node;
+                }
+                case WHILE: {
+                    AST* condition = get_node();
+                    return arena.make<WhileNode>(condition, get_node());
+                }
+                case FOR_RANGE: {
+                    VariableNode* variable = dynamic_cast<VariableNode*>(get_node());
+                    if (variable == nullptr) throw runtime_error("Bad loop variable in AST cache");
+                    AST* start = get_node();
+                    AST* stop = get_node();
+                    AST* step = get_node();
+                    return arena.make<ForRangeNode>(variable, start, stop, step, get_node());
+                }
+                case UNARY_OP: {
+                    Token op = get_op();
+                    return arena.make<UnaryOpNode>(op, get_node());
+                }
+                case BINARY_OP: {
+                    Token op = get_op();
+                    AST* left = get_node();
+                    AST* right = get_node();
+                    return arena.make<BinaryOpNode>(left, op, right);
+                }
+                case STRING: return arena.make<StringNode>(get_string());
+                case BOOL: return arena.make<BoolNode>(get_u8() != 0);
+                case INT: return arena.make<IntNode>((int64_t) get_varint());
+                case BIG_INT: {
+                    string digits = get_string();
+                    return arena.make<IntNode>(integer_result(BigInt::from_decimal(digits.data(), digits.size())));
+                }
+                case VARIABLE: return arena.make<VariableNode>(get_symbol());
+                case ASSIGN: {
+                    Token op = get_op();
+                    VariableNode* left = dynamic_cast<VariableNode*>(get_node());
+                    if (left == nullptr) throw runtime_error("Bad assignment in AST cache");
+                    return arena.make<AssignNode>(left, op, get_node());
+                }
+                case NO_OP: return arena.make<NoOp>();
+            }
+            throw runtime_error("Bad node in AST cache");
+        }
+    };
+
+    static bool make_directory(const string& directory) {
+#ifndef _WIN32
+        if (mkdir(directory.c_str(), 0777) == 0) return true;
+        struct stat info;
+        return stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#else
+        return false;
+#endif
+    }
+
+  public:
+    /* FNV-1a over the bytes, continuing from h */
+    static uint64_t hash(const char* bytes, size_t length, uint64_t h = 14695981039346656037ull) {
+        for (size_t i = 0; i < length; i++) {
+            h = (h ^ (unsigned char) bytes[i]) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    bool hit = false;
+    string directory;
+
+    /* Entries for script are kept in directory, by default a __pycache__ directory next to the script */
+    AstCache(const string& script, const char* source, size_t length, string cache_directory = "") : source_size(length) {
+        size_t slash = script.find_last_of('/');
+        string folder = slash == string::npos ? "" : script.substr(0, slash + 1);
+        string name = slash == string::npos ? script : script.substr(slash + 1);
+        directory = cache_directory.empty() ? folder + "__pycache__" : cache_directory;
+        path = directory + "/" + name + ".mpyc";
+        key = hash(source, length, hash(INTERPRETER_VERSION, strlen(INTERPRETER_VERSION)));
+    }
+
+    const string& file() const { return path; }
+
+    /* Returns the cached tree, built in arena, or nullptr when there is no valid entry for this source */
+    AST* load(Arena& arena) {
+        SourceFile mapped;
+        if (!mapped.open(path)) return nullptr;
+        try {
+            Reader reader(mapped.data(), mapped.size(), arena);
+            if (reader.get_fixed(4) != MAGIC || reader.get_fixed(8) != key || reader.get_fixed(8) != source_size)
+                return nullptr;
+            uint64_t count = reader.get_varint();
+            for (uint64_t i = 0; i < count; i++) {
+                string name = reader.get_string();
+                reader.symbols_by_id.push_back(symbols().intern(name));
+            }
+            AST* tree = reader.get_node();
+            if (!reader.at_end() || dynamic_cast<BlockNode*>(tree) == nullptr) return nullptr;
+            hit = true;
+            return tree;
+        } catch (const runtime_error&) {
+            return nullptr;
+        }
+    }
+
+    /* Writes the entry for a freshly parsed tree. A temporary file is renamed into place, so concurrent
+       runs never see half an entry. Failing to write only means the next run parses again */
+    void store(AST* tree) {
+        Writer body;
+        body.put_node(tree);
+
+        Writer header;
+        header.put_fixed(MAGIC, 4);
+        header.put_fixed(key, 8);
+        header.put_fixed(source_size, 8);
+        header.put_varint(body.names.size());
+        for (Symbol id : body.names) header.put_string(symbol_name(id));
+
+        if (!make_directory(directory)) return;
+#ifndef _WIN32
+        string temporary = path + ".tmp" + to_string(getpid());
+#else
+        string temporary = path + ".tmp";
+#endif
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr) return;
+        bool written = fwrite(header.bytes.data(), 1, header.bytes.size(), file) == header.bytes.size()
+                    && fwrite(body.bytes.data(), 1, body.bytes.size(), file) == body.bytes.size();
+        if (fclose(file) != 0 || !written || rename(temporary.c_str(), path.c_str()) != 0) remove(temporary.c_str());
+    }
+};
+
+#endif
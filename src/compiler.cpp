@@ -0,0 +1,291 @@
+#ifndef COMPILER_CPP
+#define COMPILER_CPP
+
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "ast.cpp"
+#include "operations.cpp"
+#include "symbol.cpp"
+#include "token.cpp"
+#include "value.cpp"
+
+using namespace std;
+
+enum OpCode : unsigned char {
+    LOAD_CONST,         // push constants[a]
+    LOAD_NONE,          // push the empty value
+    LOAD_FAST,          // push slot a of the current frame
+    LOAD_DEREF,         // push slot a of the frame b parent links up
+    LOAD_GLOBAL,        // push slot a of the module frame
+    STORE_FAST,         // pop into slot a of the current frame
+    STORE_GLOBAL,       // pop into slot a of the module frame
+    BINARY_OP,          // pop right, pop left, push left <a> right; b is the QuickOp seen so far
+    UNARY_OP,           // pop value, push <a> value; b is the QuickOp seen so far
+    JUMP,               // continue at a; a backward jump closes a loop
+    JUMP_IF_FALSE,      // pop condition, continue at a when it is False
+    MAKE_FUNCTION,      // push a closure of functions[a] over the current frame
+    CALL,               // call the function below the top b values with them as arguments
+    TAIL_CALL,          // like CALL, but replaces the current frame when that is safe, dropping the a values of
+                        // enclosing range loops; always followed by RETURN
+    PRINT,              // print the top b values
+    POP,                // discard the top value
+    RETURN,             // pop the return value, drop the a values of enclosing range loops and leave the frame
+    RETURN_NONE,        // drop the a values of enclosing range loops and leave the frame without a value
+    LINE,               // count a hit on line a; only emitted when profiling
+    BINARY_QUICK,       // BINARY_OP rewritten by the VM to run QuickOp b while the operands match it
+    UNARY_QUICK,        // UNARY_OP rewritten by the VM to run QuickOp b while the operand matches it
+    JUMP_IF_FALSE_OR_POP, // continue at a, keeping the condition, when it is False; pop it otherwise
+    JUMP_IF_TRUE_OR_POP,  // continue at a, keeping the condition, when it is True; pop it otherwise
+    CHECK_BOOL,         // fail unless the top value is a boolean; ends the right operand of `and` and `or`
+    FOR_RANGE_SETUP,    // check the start, stop and step on top of the stack; they stay there as the loop's state
+    FOR_RANGE           // with the loop's counter, stop and step on top, push the counter and advance it, or pop
+                        // them and continue at a when the range is exhausted
+};
+
+const char* const opcode_names[] = {
+    "LOAD_CONST", "LOAD_NONE", "LOAD_FAST", "LOAD_DEREF", "LOAD_GLOBAL", "STORE_FAST", "STORE_GLOBAL",
+    "BINARY_OP", "UNARY_OP", "JUMP", "JUMP_IF_FALSE", "MAKE_FUNCTION", "CALL", "TAIL_CALL", "PRINT", "POP",
+    "RETURN", "RETURN_NONE", "LINE", "BINARY_QUICK", "UNARY_QUICK", "JUMP_IF_FALSE_OR_POP", "JUMP_IF_TRUE_OR_POP",
+    "CHECK_BOOL", "FOR_RANGE_SETUP", "FOR_RANGE"
+};
+
+struct Instruction {
+    OpCode op;
+    int a;
+    int b;
+    Instruction(OpCode op, int a = 0, int b = 0) : op(op), a(a), b(b) {}
+};
+
+/* Bytecode for one module or function body */
+struct CodeObject {
+    string name;
+    vector<Instruction> code;
+    vector<Value> constants;
+    vector<FunctionNode*> functions;
+    const vector<Symbol>* locals;
+
+    CodeObject(string name, const vector<Symbol>* locals) : name(name), locals(locals) {}
+
+    int add_constant(Value value) {
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    int add_function(FunctionNode* function) {
+        functions.push_back(function);
+        return functions.size() - 1;
+    }
+};
+
+/* Lowers the tree from Parser::program() into a CodeObject per module and function body */
+class Compiler {
+  private:
+    CodeObject* code = nullptr;
+    CodeObject* module = nullptr;
+    const vector<Symbol>* globals;
+    vector<FunctionNode*> compiled;
+    /* Values the range loops around the statement being compiled keep on the stack, which a return drops */
+    int loop_values = 0;
+
+    int emit(OpCode op, int a = 0, int b = 0) {
+        code->code.push_back(Instruction(op, a, b));
+        return code->code.size() - 1;
+    }
+
+    void patch(int at) {
+        code->code[at].a = code->code.size();
+    }
+
+    void compile_Block(BlockNode* node) {
+        for (AST* child : node->children) {
+            compile_statement(child);
+        }
+    }
+
+    void compile_statement(AST* node_) {
+        if (trace_lines && node_->line > 0) emit(LINE, node_->line);
+        if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            compile_FunctionCall(node);
+            emit(POP);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            vector<int> to_end;
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                compile_expression(node->conditions[i]);
+                int to_next = emit(JUMP_IF_FALSE);
+                compile_statement(node->bodies[i]);
+                to_end.push_back(emit(JUMP));
+                patch(to_next);
+            }
+            compile_statement(node->else_body);
+            for (int jump : to_end) patch(jump);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            int loop = code->code.size();
+            compile_expression(node->condition);
+            int to_end = emit(JUMP_IF_FALSE);
+            compile_statement(node->body);
+            emit(JUMP, loop);
+            patch(to_end);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            compile_expression(node->start);
+            compile_expression(node->stop);
+            compile_expression(node->step);
+            emit(FOR_RANGE_SETUP);
+            int loop = emit(FOR_RANGE);
+            emit_store(node->variable->depth, node->variable->slot);
+            loop_values += 3;
+            compile_statement(node->body);
+            loop_values -= 3;
+            emit(JUMP, loop);
+            patch(loop);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node->value);
+            if (dynamic_cast<NoOp*>(node->value)) emit(RETURN_NONE, loop_values);
+            else if (call != nullptr && call->id != PRINT_SYMBOL) {
+                compile_FunctionCall(call, true);
+                emit(RETURN, loop_values);
+            } else {
+                compile_expression(node->value);
+                emit(RETURN, loop_values);
+            }
+        } else if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            compile_Block(node);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            compile_function(node);
+            emit(MAKE_FUNCTION, code->add_function(node));
+            emit_store(node->depth, node->slot);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            compile_expression(node->right);
+            emit_store(node->left->depth, node->left->slot);
+        } else if (dynamic_cast<NoOp*>(node_)) {
+            return;
+        } else throw runtime_error("Unknown AST node");
+    }
+
+    void compile_expression(AST* node_) {
+        if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            compile_FunctionCall(node);
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            emit_load(node->depth, node->slot);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            compile_expression(node->left);
+            if (is_short_circuit(node->op.type)) {
+                int to_end = emit(node->op.type == Token::AND ? JUMP_IF_FALSE_OR_POP : JUMP_IF_TRUE_OR_POP);
+                compile_expression(node->right);
+                emit(CHECK_BOOL);
+                patch(to_end);
+                return;
+            }
+            compile_expression(node->right);
+            emit(BINARY_OP, node->op.type);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            compile_expression(node->expr);
+            emit(UNARY_OP, node->op.type);
+        } else if (StringNode* node = dynamic_cast<StringNode*>(node_)) {
+            emit(LOAD_CONST, code->add_constant(node->constant));
+        } else if (BoolNode* node = dynamic_cast<BoolNode*>(node_)) {
+            emit(LOAD_CONST, code->add_constant(node->constant));
+        } else if (IntNode* node = dynamic_cast<IntNode*>(node_)) {
+            emit(LOAD_CONST, code->add_constant(node->constant));
+        } else if (dynamic_cast<NoOp*>(node_)) {
+            emit(LOAD_NONE);
+        } else throw runtime_error("Unknown AST node");
+    }
+
+    void emit_load(int depth, int slot) {
+        if (depth == GLOBAL_DEPTH) emit(LOAD_GLOBAL, slot);
+        else if (depth == 0)       emit(LOAD_FAST, slot);
+        else                       emit(LOAD_DEREF, slot, depth);
+    }
+
+    void emit_store(int depth, int slot) {
+        if (depth == GLOBAL_DEPTH) emit(STORE_GLOBAL, slot);
+        else if (depth == 0)       emit(STORE_FAST, slot);
+        else throw runtime_error("Cannot assign to an enclosing scope");
+    }
+
+    void compile_FunctionCall(FunctionCallNode* node, bool tail = false) {
+        if (node->id == PRINT_SYMBOL) {
+            for (AST* parameter : node->parameters) {
+                compile_expression(parameter);
+            }
+            emit(PRINT, 0, node->get_num_parameters());
+            return;
+        }
+        emit_load(node->depth, node->slot);
+        for (AST* parameter : node->parameters) {
+            compile_expression(parameter);
+        }
+        emit(tail ? TAIL_CALL : CALL, tail ? loop_values : 0, node->get_num_parameters());
+    }
+
+    /* A body the Parser only skimmed is compiled by compile_lazy() once it has been parsed */
+    void compile_function(FunctionNode* node) {
+        if (node->code != nullptr || node->function_body == nullptr) return;
+        CodeObject* enclosing = code;
+        int enclosing_loop_values = loop_values;
+        code = node->code = new CodeObject(symbol_name(node->id), &node->locals);
+        loop_values = 0;
+        compile_Block(node->function_body);
+        emit(RETURN_NONE);
+        functions.push_back(code);
+        compiled.push_back(node);
+        code = enclosing;
+        loop_values = enclosing_loop_values;
+    }
+
+  public:
+    vector<CodeObject*> functions;
+    /* Emit a LINE instruction before every statement, for the profiler */
+    bool trace_lines = false;
+
+    Compiler(const vector<Symbol>* globals) : globals(globals) {}
+    Compiler(const Compiler&) = delete;
+
+    /* The code objects live as long as the Compiler, and the tree can be compiled again afterwards */
+    ~Compiler() {
+        for (FunctionNode* node : compiled) node->code = nullptr;
+        for (CodeObject* function : functions) delete function;
+        delete module;
+    }
+
+    CodeObject* compile(AST* tree) {
+        code = module = new CodeObject("<module>", globals);
+        compile_statement(tree);
+        emit(RETURN_NONE);
+        return code;
+    }
+
+    /* Compiles a function whose body was parsed after the code around it was compiled */
+    void compile_lazy(FunctionNode* node) {
+        compile_function(node);
+    }
+
+    void disassemble(CodeObject* object) {
+        cout << "code object " << object->name << ":" << endl;
+        for (size_t i = 0; i < object->code.size(); i++) {
+            const Instruction& ins = object->code[i];
+            cout << setw(6) << i << "  " << left << setw(21) << opcode_names[ins.op] << right;
+            if (ins.op == LOAD_FAST || ins.op == STORE_FAST)
+                cout << ins.a << " (" << symbol_name(object->locals->at(ins.a)) << ")";
+            else if (ins.op == LOAD_GLOBAL || ins.op == STORE_GLOBAL)
+                cout << ins.a << " (" << symbol_name(globals->at(ins.a)) << ")";
+            else if (ins.op == LOAD_DEREF)
+                cout << ins.a << ", " << ins.b;
+            else if (ins.op == MAKE_FUNCTION)
+                cout << ins.a << " (" << symbol_name(object->functions[ins.a]->id) << ")";
+            else if (ins.op == CALL || ins.op == PRINT)
+                cout << ins.b;
+            else if (ins.op == TAIL_CALL)
+                cout << ins.b << (ins.a > 0 ? ", dropping " + to_string(ins.a) : "");
+            else if (ins.op == RETURN || ins.op == RETURN_NONE)
+                cout << (ins.a > 0 ? "dropping " + to_string(ins.a) : "");
+            else if (ins.op != LOAD_NONE && ins.op != POP && ins.op != CHECK_BOOL && ins.op != FOR_RANGE_SETUP)
+                cout << ins.a;
+            cout << endl;
+        }
+    }
+};
+
+#endif
@@ -1,263 +1,676 @@
 #ifndef INTERPRETER_CPP
 #define INTERPRETER_CPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
-#include <fstream>
+#include <set>
 #include <stdexcept>
+#include "arena.cpp"
 #include "ast.cpp"
+#include "cache.cpp"
+#include "compiler.cpp"
+#include "memo.cpp"
+#include "operations.cpp"
+#include "optimizer.cpp"
+#include "output.cpp"
 #include "parser.cpp"
+#include "profiler.cpp"
+#include "resolver.cpp"
 #include "scanner.cpp"
 #include "scope.cpp"
+#include "source.cpp"
+#include "stack.cpp"
 #include "token.cpp"
+#include "value.cpp"
+#include "vm.cpp"
 
 using namespace std;
 
+/* Deepest call nesting allowed before a RecursionError */
+const size_t DEFAULT_RECURSION_LIMIT = 10000;
+
+/* The walker makes every call that is not a tail call natively, so it runs on a thread of its own whose stack
+   has this much room per level of the recursion limit, on top of a base, up to the limit below. Should a
+   script nest its calls in deeper expressions than that allows for, a call that finds less than the
+   reserve left raises RecursionError instead of overflowing the stack */
+const size_t WALKER_STACK_BASE = 8 << 20;
+const size_t WALKER_STACK_PER_CALL = 4 << 10;
+const size_t WALKER_STACK_MAX_CALLS = 1 << 18;
+const size_t WALKER_STACK_RESERVE = 256 << 10;
+
+/* Binding versions are unique across every Interpreter in the process, so a call site cache filled by
+   one run of a tree can never be mistaken for valid by another */
+inline unsigned long new_binding_version() {
+    static atomic<unsigned long> next(1);
+    return next++;
+}
+
+/* A top-level statement kept after streaming ran it, because it defines functions that may still be
+   called. Its nodes and the bytecode the VM compiled from them are released together */
+struct StreamUnit {
+    Arena arena;
+    Compiler* compiler = nullptr;
+    vector<FunctionNode*> functions;
+    StreamUnit() {}
+    StreamUnit(const StreamUnit&) = delete;
+    ~StreamUnit() {
+        delete compiler;
+    }
+};
+
 class Interpreter {
   private:
-    Parser parser;
-    Scope* current_scope = new Scope();
+    Parser& parser;
+    Resolver resolver;
+    Optimizer optimizer;
+    PurityAnalysis purity;
+    Scope* globals = nullptr;
+    Scope* current_scope = nullptr;
+    size_t call_depth = 0;
+    bool tail_call_pending = false;
+    Scope* tail_scope = nullptr;
+    FunctionNode* tail_function = nullptr;
+    vector<Value> print_arguments;
+    /* Lowest address the walker's calls may reach on the thread it runs on, 0 when it is not known */
+    uintptr_t stack_floor = 0;
+    /* Changes whenever a module slot holding a function is rebound, invalidating every call site cache */
+    unsigned long binding_version = new_binding_version();
+    /* Streaming: the statements kept for their functions, the compiler of the statement running now,
+       and the number of kept statements at which they are next checked for functions still in use */
+    vector<StreamUnit*> stream_units;
+    Compiler* stream_compiler = nullptr;
+    size_t next_sweep = 16;
+    /* The compiler execute() is running the program with, which also compiles bodies parsed lazily */
+    Compiler* active_compiler = nullptr;
 
   public:
-    Interpreter(Parser& p) : parser(p) {}
-
-    /* Handles boolean operations */
-    AST* compute_BoolOp(AST* first, Token op, AST* second = nullptr) {
-        /* Unary operations */
-        bool val1 = dynamic_cast<BoolNode*>(first)->value;
-        if (second == nullptr) {
-            if (op.type == Token::NOT) return new BoolNode(!val1);
-            throw runtime_error("Invalid operation");
+    bool TREE_MODE = false;
+    bool OPTIMIZE = true;
+    bool STATS_MODE = false;
+    bool MEMOIZE = false;
+    bool QUICKEN = true;
+    bool STREAM = false;
+    size_t RECURSION_LIMIT = DEFAULT_RECURSION_LIMIT;
+    AstCache* cache = nullptr;
+    OutputSink* out = &output();
+    /* Where --stats and --memoize report */
+    ostream* diagnostics = &cerr;
+    Profiler* profiler = nullptr;
+    /* When streaming, the pages of this file that have already run are let go as it goes */
+    SourceFile* source = nullptr;
+    long long call_cache_hits = 0;
+    long long call_cache_misses = 0;
+    /* Operator sites specialized to their operand types, and those that later fell back to generic */
+    long long quickened = 0;
+    long long deoptimized = 0;
+    /* Top-level statements run by stream(), how many of them are kept, and the largest one's AST in bytes */
+    long long statements_streamed = 0;
+    size_t largest_statement = 0;
+    /* Skimmed function bodies that were called, and so parsed */
+    size_t bodies_loaded = 0;
+    Interpreter(Parser& p) : parser(p), optimizer(p.arena) {}
+    Interpreter(const Interpreter&) = delete;
+    /* Drops the module frame, and with it every value the program left behind */
+    ~Interpreter() {
+        if (globals != nullptr) Scope::exit(globals);
+        delete stream_compiler;
+        for (StreamUnit* unit : stream_units) delete unit;
+    }
+
+    /* How an operator site evaluates an operand node. Found with the dynamic_casts of visit() the first
+       time the site runs and kept, since the tree no longer changes shape once it runs */
+    enum OperandKind : unsigned char {
+        OPERAND_UNSEEN, OPERAND_INT, OPERAND_STRING, OPERAND_BOOL, OPERAND_VARIABLE, OPERAND_BINARY, OPERAND_OTHER
+    };
+
+    static OperandKind operand_kind(AST* node) {
+        if (dynamic_cast<IntNode*>(node))      return OPERAND_INT;
+        if (dynamic_cast<StringNode*>(node))   return OPERAND_STRING;
+        if (dynamic_cast<BoolNode*>(node))     return OPERAND_BOOL;
+        if (dynamic_cast<VariableNode*>(node)) return OPERAND_VARIABLE;
+        if (dynamic_cast<BinaryOpNode*>(node)) return OPERAND_BINARY;
+        return OPERAND_OTHER;
+    }
+
+    Value visit_operand(AST* node, unsigned char& kind) {
+        switch (kind) {
+            case OPERAND_INT:      return static_cast<IntNode*>(node)->constant;
+            case OPERAND_STRING:   return static_cast<StringNode*>(node)->constant;
+            case OPERAND_BOOL:     return static_cast<BoolNode*>(node)->constant;
+            case OPERAND_VARIABLE: return visit_Variable(static_cast<VariableNode*>(node));
+            case OPERAND_BINARY:   return visit_BinaryOp(static_cast<BinaryOpNode*>(node));
+            case OPERAND_UNSEEN:
+                if (!QUICKEN) return visit(node);
+                kind = operand_kind(node);
+                return visit_operand(node, kind);
+            default:               return visit(node);
         }
+    }
 
-        /* Binary operations */
-        bool val2 = dynamic_cast<BoolNode*>(second)->value;
-        if (op.type == Token::OR)         return new BoolNode(val1 || val2);
-        if (op.type == Token::AND)        return new BoolNode(val1 && val2);
-        if (op.type == Token::EQUALS)     return new BoolNode(val1 == val2);
-        if (op.type == Token::NOT_EQUALS) return new BoolNode(val1 != val2);
-        throw runtime_error("Invalid operation");
-    }
-
-    /* Handles integer operations */
-    AST* compute_IntOp(AST* first, Token op, AST* second = nullptr) {
-        /* Unary operations */
-        int val1 = dynamic_cast<IntNode*>(first)->value;
-        if (second == nullptr) {
-            if (op.type == Token::PLUS)  return new IntNode(+val1);
-            if (op.type == Token::MINUS) return new IntNode(-val1);
-            throw runtime_error("Invalid operation");
+    /* `and` and `or`: the right operand is only evaluated when the left one does not decide the result */
+    Value visit_ShortCircuit(BinaryOpNode* node) {
+        Value left = visit_operand(node->left, node->left_kind);
+        if (decides_short_circuit(node->op.type, left)) return left;
+        return short_circuit_result(visit_operand(node->right, node->right_kind));
+    }
+
+    /* Handles two-operand operations. A site runs as the quickened form for the operands it first saw,
+       and falls back to the generic operation for good when they change type */
+    Value visit_BinaryOp(BinaryOpNode* node) {
+        if (is_short_circuit(node->op.type)) return visit_ShortCircuit(node);
+        Value left = visit_operand(node->left, node->left_kind);
+        Value right = visit_operand(node->right, node->right_kind);
+        QuickOp quick = (QuickOp) node->quick;
+        if (quick > QUICK_GENERIC) {
+            Value::Type type = quick_operand_type(quick);
+            if (left.type == type && right.type == type) return compute_QuickBinary(quick, left, right);
+            node->quick = QUICK_GENERIC;
+            deoptimized++;
+        } else if (quick == QUICK_UNSEEN && QUICKEN) {
+            node->quick = specialize_BinaryOp(left, node->op.type, right);
+            if (node->quick != QUICK_GENERIC) quickened++;
         }
+        return compute_BinaryOp(left, node->op.type, right);
+    }
 
-        /* Binary operations */
-        int val2 = dynamic_cast<IntNode*>(second)->value;
-        if (op.type == Token::PLUS)                return new IntNode(val1 + val2);
-        if (op.type == Token::MINUS)               return new IntNode(val1 - val2);
-        if (op.type == Token::TIMES)               return new IntNode(val1 * val2);
-        if (op.type == Token::DIVIDE)              return new IntNode(val1 / val2);
-        if (op.type == Token::EQUALS)              return new BoolNode(val1 == val2);
-        if (op.type == Token::NOT_EQUALS)          return new BoolNode(val1 != val2);
-        if (op.type == Token::LESS_THAN)           return new BoolNode(val1 <  val2);
-        if (op.type == Token::GREATER_THAN)        return new BoolNode(val1 >  val2);
-        if (op.type == Token::LESS_THAN_EQUALS)    return new BoolNode(val1 <= val2);
-        if (op.type == Token::GREATER_THAN_EQUALS) return new BoolNode(val1 >= val2);
-        throw runtime_error("Invalid operation");
-    }
-
-    /* Handles string operations */
-    AST* compute_StringOp(AST* first, Token op, AST* second) {
-        string text1 = dynamic_cast<StringNode*>(first)->text;
-        string text2 = dynamic_cast<StringNode*>(second)->text;
-        if (op.type == Token::PLUS)                return new StringNode(text1 + text2);
-        if (op.type == Token::EQUALS)              return new BoolNode(text1 == text2);
-        if (op.type == Token::NOT_EQUALS)          return new BoolNode(text1 != text2);
-        if (op.type == Token::LESS_THAN)           return new BoolNode(text1 <  text2);
-        if (op.type == Token::GREATER_THAN)        return new BoolNode(text1 >  text2);
-        if (op.type == Token::LESS_THAN_EQUALS)    return new BoolNode(text1 <= text2);
-        if (op.type == Token::GREATER_THAN_EQUALS) return new BoolNode(text1 >= text2);
-        throw runtime_error("Invalid operation");
-    }
-
-    /* Handles two-operand operations */
-    AST* visit_BinaryOp(BinaryOpNode* node) {
-        AST* left = visit(node->left);
-        AST* right = visit(node->right);
-        if (dynamic_cast<BoolNode*>(left) && dynamic_cast<BoolNode*>(right))
-            return compute_BoolOp(left, node->op, right);
-        if (dynamic_cast<IntNode*>(left) && dynamic_cast<IntNode*>(right))
-            return compute_IntOp(left, node->op, right);
-        if (dynamic_cast<StringNode*>(left) && dynamic_cast<StringNode*>(right))
-            return compute_StringOp(left, node->op, right);
-        throw runtime_error("Invalid operand type");
-    }
-
-    /* Handles one-operand operations */
-    AST* visit_UnaryOp(UnaryOpNode* node) {
-        AST* value = visit(node->expr);
-        if (dynamic_cast<BoolNode*>(value))
-            return compute_BoolOp(value, node->op);
-        if (dynamic_cast<IntNode*>(value))
-            return compute_IntOp(value, node->op);
-        else throw runtime_error("Invalid operand type");
-    }
-
-    /* Variable node, look up the variable value from current scope using the variable id */
-    AST* visit_Variable(VariableNode* node) {
-        AST* value = current_scope->get(node->id);
-        if (value != nullptr) return value;
-        else throw runtime_error("NameError: \"" + node->id + "\"");
-    }
-
-    /* Print function, handles any amount of arguments of type [Bool, String, Int] */
-    AST* visit_PrintFunction(FunctionCallNode* node) {
-        string result = "";
-        for (AST* param : node->parameters) {
-            AST* var =  visit(param);
-            if (StringNode* varString = dynamic_cast<StringNode*>(var)) {
-                result += varString->text;
-            } else if (BoolNode* varBool = dynamic_cast<BoolNode*>(var)) {
-                result += (varBool->value ? "True" : "False");
-            } else if (IntNode* varInt = dynamic_cast<IntNode*>(var)) {
-                result += to_string(varInt->value);
-            }
-            result += " ";
+    /* Handles one-operand operations, quickened like visit_BinaryOp */
+    Value visit_UnaryOp(UnaryOpNode* node) {
+        Value value = visit_operand(node->expr, node->expr_kind);
+        QuickOp quick = (QuickOp) node->quick;
+        if (quick > QUICK_GENERIC) {
+            if (value.type == quick_operand_type(quick)) return compute_QuickUnary(quick, value);
+            node->quick = QUICK_GENERIC;
+            deoptimized++;
+        } else if (quick == QUICK_UNSEEN && QUICKEN) {
+            node->quick = specialize_UnaryOp(node->op.type, value);
+            if (node->quick != QUICK_GENERIC) quickened++;
         }
-        result[result.length()-1] = '\n';
-        cout << result;
-        return nullptr;
+        return compute_UnaryOp(node->op.type, value);
+    }
+
+    /* Returns the slot a resolved name refers to, starting from the current frame */
+    Value& lookup(int depth, int slot) {
+        return depth == GLOBAL_DEPTH ? globals->slots[slot] : current_scope->get(depth, slot);
+    }
+
+    /* Variable node, read the slot the Resolver assigned to the variable */
+    Value visit_Variable(VariableNode* node) {
+        const Value& value = lookup(node->depth, node->slot);
+        if (!value.is_unbound()) return value;
+        else throw runtime_error("NameError: \"" + symbol_name(node->id) + "\"");
+    }
+
+    /* Print function, handles any amount of arguments of type [Bool, String, Int]. Every argument is
+       evaluated before anything is written, so prints made while evaluating them come out first */
+    Value visit_PrintFunction(FunctionCallNode* node) {
+        size_t base = print_arguments.size();
+        for (AST* param : node->parameters) print_arguments.push_back(visit(param));
+        out->print(print_arguments.data() + base, print_arguments.size() - base);
+        print_arguments.resize(base);
+        return Value();
+    }
+
+    /* Finds and checks the function a call refers to. Targets in the module frame are cached in the call
+       site until a module slot holding a function is rebound; others are in frames that come and go,
+       so they are looked up every time */
+    Closure* resolve_call(FunctionCallNode* call) {
+        if (call->cached_version == binding_version) {
+            call_cache_hits++;
+            return call->cached_target;
+        }
+        const Value& callee = lookup(call->depth, call->slot);
+        if (callee.is_unbound())
+            throw runtime_error("NameError: \"" + symbol_name(call->id) + "\"");
+        if (callee.type != Value::FUNCTION)
+            throw runtime_error("Invalid function");
+        if (callee.closure->function->get_num_parameters() != call->get_num_parameters())
+            throw runtime_error("Invalid number of parameters");
+        if (call->depth == GLOBAL_DEPTH) {
+            call_cache_misses++;
+            call->cached_target = callee.closure;
+            call->cached_version = binding_version;
+        }
+        return callee.closure;
+    }
+
+    /* Stores into a slot. Rebinding a module slot that holds a function invalidates the call site caches */
+    void bind(int depth, int slot, Value value) {
+        Value& target = lookup(depth, slot);
+        if (depth == GLOBAL_DEPTH && target.type == Value::FUNCTION) binding_version = new_binding_version();
+        target = move(value);
+    }
+
+    /* Readies a function the Parser only skimmed, on its first call: its body is parsed, resolved and
+       optimized, and on the VM compiled, with the same passes the rest of the program went through.
+       The body may name globals nothing else did, so the module frame grows to fit them. A body that fails
+       to parse or resolve is not kept, and the next call tries again */
+    void load_function(FunctionNode* function) {
+        if (function->function_body == nullptr) {
+            BlockNode* body = parser.parse_body(function);
+            resolver.resolve_lazy(function, body);
+            function->function_body = body;
+            if (OPTIMIZE) optimizer.optimize_lazy(function);
+            globals->resize(resolver.globals.size());
+            bodies_loaded++;
+        }
+        if (active_compiler != nullptr && function->code == nullptr) active_compiler->compile_lazy(function);
+    }
+
+    static void load_for_vm(void* interpreter, FunctionNode* function) {
+        static_cast<Interpreter*>(interpreter)->load_function(function);
     }
 
     /* Function call node, check for params and update scope based on function definitions, then execute the function body */
-    AST* visit_FunctionCall(FunctionCallNode* function_call) {
-        if (function_call->id == "print")
+    Value visit_FunctionCall(FunctionCallNode* function_call) {
+        if (function_call->id == PRINT_SYMBOL)
             return visit_PrintFunction(function_call);
-        
-        FunctionNode* function_def = dynamic_cast<FunctionNode*>(current_scope->get(function_call->id));
-        if (!function_def)
-            throw runtime_error("Invalid function");
 
-        int expected_params = function_def->get_num_parameters();
+        Closure* callee = resolve_call(function_call);
+        FunctionNode* function_def = callee->function;
+        if (function_def->function_body == nullptr) load_function(function_def);
         int passed_params = function_call->get_num_parameters();
-        if (expected_params != passed_params)
-            throw runtime_error("Invalid number of parameters");
 
         Scope* fallback = current_scope;
-        Scope* parent = current_scope->get_local(function_call->id) ? current_scope : current_scope->get_parent();;
-        Scope* child = new Scope(parent);
+        FrameExit child(new Scope(callee->env, function_def->locals.size(), &function_def->locals));
 
         for (int i = 0; i < function_def->get_num_parameters(); i++) {
-            string parameter_id = function_def->parameters.at(i);
-            AST* parameter_value = visit(function_call->parameters.at(i));
-            child->set(parameter_id, parameter_value);
+            child.frame->slots[i] = visit(function_call->parameters.at(i));
+        }
+
+        /* Pure functions return the remembered result for arguments they have seen before */
+        vector<Value> memo_key;
+        if (function_def->memo != nullptr) {
+            memo_key.assign(child.frame->slots.begin(), child.frame->slots.begin() + passed_params);
+            if (const Value* remembered = function_def->memo->lookup(memo_key)) {
+                if (profiler != nullptr) profiler->memo_hit(function_def);
+                return *remembered;
+            }
         }
 
-        current_scope = child;
-        AST* result = visit_Block(function_def->function_body);
+        if (++call_depth > RECURSION_LIMIT || stack_exhausted()) {
+            call_depth--;
+            throw runtime_error("RecursionError: maximum recursion depth exceeded");
+        }
+        current_scope = child.frame;
+        if (profiler != nullptr) profiler->enter(function_def);
+        Value result = visit_Block(function_def->function_body);
+
+        /* A return of a call hands its target back here instead of recursing, so the frame is reused */
+        while (tail_call_pending) {
+            tail_call_pending = false;
+            Scope::exit(child.frame);
+            current_scope = child.frame = tail_scope;
+            if (profiler != nullptr) profiler->tail_call(tail_function);
+            result = visit_Block(tail_function->function_body);
+        }
 
-        Scope* temp = current_scope;
+        if (profiler != nullptr) profiler->leave();
         current_scope = fallback;
-        delete temp;
+        call_depth--;
+        if (function_def->memo != nullptr) function_def->memo->insert(move(memo_key), result);
         return result;
     }
 
-    AST* visit_Return(ReturnNode* node) {
-        return visit(node->value);
+    bool stack_exhausted() {
+        char marker;
+        return (uintptr_t) &marker < stack_floor;
     }
 
-    AST* visit_Conditional(ConditionalNode* node) {
-        bool condition = dynamic_cast<BoolNode*>(visit(node->condition))->value;
-        return (condition ? visit(node->if_body) : visit(node->else_body));
+    /* Runs body on a thread with a native stack sized for the recursion limit, for the walker */
+    void on_walker_stack(const function<void()>& body) {
+        size_t wanted = WALKER_STACK_BASE + min(RECURSION_LIMIT, WALKER_STACK_MAX_CALLS) * WALKER_STACK_PER_CALL;
+        run_on_stack(wanted, [this, &body](size_t size) {
+            char top;
+            stack_floor = size > WALKER_STACK_RESERVE ? (uintptr_t) &top - (size - WALKER_STACK_RESERVE) : 0;
+            try {
+                body();
+            } catch (...) {
+                stack_floor = 0;
+                throw;
+            }
+            stack_floor = 0;
+        });
+    }
+
+    /* `return f(...)` inside a function hands f back to visit_FunctionCall instead of recursing, unless f was
+       defined in the current frame, which must then stay alive. A memoized f still answers from its table */
+    Value visit_Return(ReturnNode* node) {
+        FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node->value);
+        if (call == nullptr || call->id == PRINT_SYMBOL || call_depth == 0) return visit(node->value);
+        Closure* callee = resolve_call(call);
+        if (callee->env == current_scope) return visit(node->value);
+
+        FunctionNode* function_def = callee->function;
+        if (function_def->function_body == nullptr) load_function(function_def);
+        Scope* child = new Scope(callee->env, function_def->locals.size(), &function_def->locals);
+        try {
+            for (int i = 0; i < function_def->get_num_parameters(); i++) {
+                child->slots[i] = visit(call->parameters.at(i));
+            }
+        } catch (...) {
+            Scope::exit(child);
+            throw;
+        }
+        if (function_def->memo != nullptr) {
+            vector<Value> key(child->slots.begin(), child->slots.begin() + call->get_num_parameters());
+            if (const Value* remembered = function_def->memo->lookup(key)) {
+                if (profiler != nullptr) profiler->memo_hit(function_def);
+                Scope::exit(child);
+                return *remembered;
+            }
+        }
+        tail_scope = child;
+        tail_function = function_def;
+        tail_call_pending = true;
+        /* The unbound marker is never a real result, it only makes the enclosing blocks stop */
+        return Value::unbound();
+    }
+
+    /* Tries the conditions of an if and its elif branches in turn, and runs the body of the first that holds */
+    Value visit_Conditional(ConditionalNode* node) {
+        for (size_t i = 0; i < node->conditions.size(); i++) {
+            Value condition = visit(node->conditions[i]);
+            if (condition.type != Value::BOOL)
+                throw runtime_error("Invalid condition type");
+            if (condition.boolean) return visit(node->bodies[i]);
+        }
+        return visit(node->else_body);
+    }
+
+    /* A loop body, dispatched once rather than on every pass */
+    Value visit_LoopBody(BlockNode* block, AST* body) {
+        return block != nullptr ? visit_Block(block) : visit(body);
+    }
+
+    /* Loops until the condition is False. A return in the body ends the loop with its value */
+    Value visit_While(WhileNode* node) {
+        BlockNode* block = dynamic_cast<BlockNode*>(node->body);
+        for (;;) {
+            Value condition = visit(node->condition);
+            if (condition.type != Value::BOOL)
+                throw runtime_error("Invalid condition type");
+            if (!condition.boolean) return Value();
+            Value result = visit_LoopBody(block, node->body);
+            if (!result.is_none()) return result;
+        }
+    }
+
+    /* Counts through the range in a machine integer, without materializing it, binding the loop variable
+       at the top of each pass */
+    Value visit_ForRange(ForRangeNode* node) {
+        Value start = visit(node->start);
+        Value end = visit(node->stop);
+        Value increment = visit(node->step);
+        int64_t counter = range_bound(start);
+        int64_t stop = range_bound(end);
+        int64_t step = range_step(increment);
+        VariableNode* variable = node->variable;
+        BlockNode* block = dynamic_cast<BlockNode*>(node->body);
+        for (; range_continues(counter, stop, step); range_advance(counter, stop, step)) {
+            bind(variable->depth, variable->slot, Value::make_int(counter));
+            Value result = visit_LoopBody(block, node->body);
+            if (!result.is_none()) return result;
+        }
+        return Value();
     }
 
     /* Block node, visit all statements, definitions, or function calls. Exits the block when a value is returned */
-    AST* visit_Block(BlockNode* node) {
+    Value visit_Block(BlockNode* node) {
         for (AST* child : node->children) {
+            if (profiler != nullptr && child->line > 0) profiler->line(child->line);
             if (dynamic_cast<FunctionCallNode*>(child)) {
                 visit(child);
             } else {
-                AST* result = visit(child);
-                if (result != nullptr) {
+                Value result = visit(child);
+                if (!result.is_none()) {
                     return result;
                 }
             }
         }
-        return nullptr;
+        return Value();
     }
 
     void visit_FunctionDefinition(FunctionNode* node) {
-        current_scope->set(node->id, node);
+        bind(node->depth, node->slot, Value::make_function(new Closure(node, current_scope)));
     }
-    
+
     void visit_Assign(AssignNode* node) {
-        current_scope->set(node->left->id, visit(node->right));
+        bind(node->left->depth, node->left->slot, visit(node->right));
     }
 
-    AST* visit(AST* node_) {
+    /* Every kind tried before the right one costs a dynamic_cast, so the kinds that run most come first:
+       calls, and the assignments loop bodies are mostly made of */
+    Value visit(AST* node_) {
         if      (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) return visit_FunctionCall(node);
+        else if (AssignNode* node = dynamic_cast<AssignNode*>(node_))             visit_Assign(node);
         else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_))   return visit_Conditional(node);
         else if (VariableNode* node = dynamic_cast<VariableNode*>(node_))         return visit_Variable(node);
         else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_))         return visit_BinaryOp(node);
         else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_))           return visit_UnaryOp(node);
         else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_))             return visit_Return(node); 
+        else if (WhileNode* node = dynamic_cast<WhileNode*>(node_))               return visit_While(node);
+        else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_))         return visit_ForRange(node);
         else if (BlockNode* node = dynamic_cast<BlockNode*>(node_))               return visit_Block(node);
-        else if (StringNode* node = dynamic_cast<StringNode*>(node_))             return node;
-        else if (BoolNode* node = dynamic_cast<BoolNode*>(node_))                 return node;
-        else if (IntNode* node = dynamic_cast<IntNode*>(node_))                   return node;
-        else if (NoOp* node = dynamic_cast<NoOp*>(node_))                         return nullptr;
+        else if (StringNode* node = dynamic_cast<StringNode*>(node_))             return node->constant;
+        else if (BoolNode* node = dynamic_cast<BoolNode*>(node_))                 return node->constant;
+        else if (IntNode* node = dynamic_cast<IntNode*>(node_))                   return node->constant;
+        else if (dynamic_cast<NoOp*>(node_))                                      return Value();
         else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_))         visit_FunctionDefinition(node);
-        else if (AssignNode* node = dynamic_cast<AssignNode*>(node_))             visit_Assign(node);
         else throw runtime_error("Unknown AST node");
-        return 0;
+        return Value();
     }
 
-    int interpret() {
-        AST* tree = parser.program();
+    /* Compiles the tree to bytecode and runs it on the VM */
+    void execute(AST* tree) {
+        Compiler compiler(&resolver.globals);
+        compiler.trace_lines = profiler != nullptr;
+        CodeObject* module = compiler.compile(tree);
         if (parser.DEBUG_MODE) {
-            cout << endl << "Program output:" << endl;
+            cout << endl << "Bytecode:" << endl;
             cout << "-------------------------------" << endl;
-            visit(tree);
+            compiler.disassemble(module);
+            for (CodeObject* function : compiler.functions) compiler.disassemble(function);
             cout << "-------------------------------" << endl << endl;
-        } else visit(tree);
-        return 0;
+        }
+        VM vm(RECURSION_LIMIT, *out);
+        vm.profiler = profiler;
+        vm.quicken = QUICKEN;
+        vm.load_function = &Interpreter::load_for_vm;
+        vm.loader = this;
+        active_compiler = &compiler;
+        vm.run(module, globals);
+        active_compiler = nullptr;
+        quickened += vm.quickened;
+        deoptimized += vm.deoptimized;
     }
-};
 
-string readFileIntoString(const string& filePath) {
-    ifstream file(filePath);
-    if (!file.is_open()) {
-        cerr << "Error: Unable to open file " << filePath << endl;
-        return "";
+    /* Reports what the optional passes and caches did, on stderr so program output is unaffected */
+    void print_stats() {
+        if (STATS_MODE && TREE_MODE) {
+            *diagnostics << "call cache: " << call_cache_hits << " hits, " << call_cache_misses << " misses" << endl;
+        }
+        if (STATS_MODE && QUICKEN) {
+            *diagnostics << "quickening: " << quickened << " operator sites specialized, " << deoptimized
+                 << " fell back to generic" << endl;
+        }
+        if (STATS_MODE && STREAM) {
+            *diagnostics << "stream: " << statements_streamed << " statements, " << stream_units.size()
+                 << " kept for their functions, largest " << largest_statement << " bytes of AST" << endl;
+        }
+        if (STATS_MODE && parser.tokens.chunk_count > 0) {
+            *diagnostics << "lexer: " << parser.tokens.size() << " tokens scanned in " << parser.tokens.chunk_count
+                 << " chunks, " << parser.tokens.rescanned << " rescanned after a \"\"\" comment" << endl;
+        }
+        if (STATS_MODE && parser.LAZY) {
+            *diagnostics << "lazy: " << bodies_loaded << " of " << parser.skimmed << " skimmed function bodies parsed, "
+                 << parser.arena.used() << " bytes of AST" << endl;
+        }
+        if (STATS_MODE && cache != nullptr) {
+            *diagnostics << "cache: " << (cache->hit ? "hit " : "miss, wrote ") << cache->file() << endl;
+        }
+        if (MEMOIZE) {
+            *diagnostics << "memo: " << purity.hits() << " hits, " << purity.misses() << " misses across "
+                 << purity.tables.size() << " pure functions" << endl;
+        }
+        if (STATS_MODE && OPTIMIZE) {
+            *diagnostics << "optimizer: removed " << optimizer.removed() << " of " << optimizer.nodes_before << " nodes ("
+                 << optimizer.folded << " folded, " << optimizer.propagated << " propagated, "
+                 << optimizer.pruned << " branches pruned)" << endl;
+        }
     }
-    string content;
-    string line;
-    while (getline(file, line)) {
-        content += line + "\n";
+
+    /* Front half of the pipeline: parses (or loads the cached tree), resolves, optimizes and analyzes the program */
+    AST* prepare() {
+        AST* tree = cache != nullptr ? cache->load(parser.arena) : nullptr;
+        if (tree == nullptr) {
+            tree = parser.program();
+            if (cache != nullptr) cache->store(tree);
+        } else if (parser.DEBUG_MODE) {
+            cout << endl << "AST loaded from " << cache->file() << ": " << parser.arena.node_count() << " nodes" << endl;
+        }
+        resolver.resolve_program(tree);
+        if (OPTIMIZE) tree = optimizer.optimize(tree);
+        if (MEMOIZE) purity.analyze(tree);
+        return tree;
     }
-    file.close();
-    return content;
-}
 
-#endif
+    /* Slot names of the module frame, once prepare() has resolved the program */
+    const vector<Symbol>& global_names() const {
+        return resolver.globals;
+    }
+
+    /* Back half: creates the module frame and runs a prepared tree on the chosen backend. Running
+       the same tree again starts from a fresh module frame, even after a run that stopped with an error */
+    void run(AST* tree) {
+        if (globals != nullptr) Scope::exit(globals);
+        call_depth = 0;
+        tail_call_pending = false;
+        active_compiler = nullptr;
+        print_arguments.clear();
+        binding_version = new_binding_version();
+        current_scope = globals = new Scope(nullptr, resolver.globals.size(), &resolver.globals);
+        if (profiler != nullptr) profiler->start();
+        if (TREE_MODE) on_walker_stack([this, tree] { visit(tree); });
+        else execute(tree);
+    }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <file_path>" << endl;
-        return 1;
+    /* Adds the functions defined anywhere in a statement, nested ones included */
+    static void collect_functions(AST* node_, vector<FunctionNode*>& functions) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) collect_functions(child, functions);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (AST* body : node->bodies) collect_functions(body, functions);
+            collect_functions(node->else_body, functions);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            collect_functions(node->body, functions);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            collect_functions(node->body, functions);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            functions.push_back(node);
+            collect_functions(node->function_body, functions);
+        }
     }
 
-    string filePath = argv[1];
-    string fileContent = readFileIntoString(filePath);
+    /* Releases the kept statements none of whose functions can be called any more. Between statements
+       the module frame is the only root: a closure is live when it can be reached from its slots,
+       directly or through the frames of other live closures */
+    void sweep_stream_units() {
+        set<FunctionNode*> live;
+        set<Scope*> seen;
+        vector<Scope*> pending(1, globals);
+        seen.insert(globals);
+        while (!pending.empty()) {
+            Scope* scope = pending.back();
+            pending.pop_back();
+            for (const Value& value : scope->slots) {
+                if (value.type != Value::FUNCTION) continue;
+                live.insert(value.closure->function);
+                for (Scope* env = value.closure->env; env != nullptr && seen.insert(env).second; env = env->parent) {
+                    pending.push_back(env);
+                }
+            }
+        }
+        size_t kept = 0;
+        for (StreamUnit* unit : stream_units) {
+            bool used = false;
+            for (FunctionNode* function : unit->functions) used = used || live.count(function) > 0;
+            if (used) stream_units[kept++] = unit;
+            else delete unit;
+        }
+        stream_units.resize(kept);
+        next_sweep = 2 * kept + 16;
+    }
+
+    /* Parses, resolves and runs the program one top-level statement at a time, and drops each statement's
+       AST once it has run, so memory is bounded by the largest statement rather than by the file.
+       A statement that defines functions is kept while any of them can still be called. The optimizer,
+       memoization and the AST cache all need the whole program, so they are not used here */
+    void stream() {
+        if (TREE_MODE) on_walker_stack([this] { stream_statements(); });
+        else stream_statements();
+    }
+
+    void stream_statements() {
+        if (globals != nullptr) Scope::exit(globals);
+        binding_version = new_binding_version();
+        current_scope = globals = new Scope(nullptr, 0, &resolver.globals);
+        if (profiler != nullptr) profiler->start();
+        VM vm(RECURSION_LIMIT, *out);
+        vm.profiler = profiler;
+        vm.quicken = QUICKEN;
+
+        parser.begin_statements();
+        while (AST* statement = parser.next_statement()) {
+            statements_streamed++;
+            resolver.resolve_program(statement);
+            globals->resize(resolver.globals.size());
+            if (TREE_MODE) {
+                /* A value returned at the top level ends the program, as it does in visit_Block */
+                if (!visit(statement).is_none()) break;
+            } else {
+                stream_compiler = new Compiler(&resolver.globals);
+                stream_compiler->trace_lines = profiler != nullptr;
+                vm.run(stream_compiler->compile(statement), globals);
+            }
 
-    Scanner scanner(fileContent);
-    Parser parser(scanner);
-    Interpreter interpreter(parser);
+            largest_statement = max(largest_statement, parser.arena.used());
+            vector<FunctionNode*> functions;
+            collect_functions(statement, functions);
+            if (functions.empty()) {
+                delete stream_compiler;
+                parser.arena.clear();
+            } else {
+                StreamUnit* unit = new StreamUnit();
+                parser.arena.move_into(unit->arena);
+                unit->compiler = stream_compiler;
+                unit->functions = move(functions);
+                stream_units.push_back(unit);
+                /* The profiler names functions by their nodes when it reports, so it keeps every one */
+                if (stream_units.size() >= next_sweep && profiler == nullptr) sweep_stream_units();
+            }
+            stream_compiler = nullptr;
+            if (source != nullptr) source->discard_before(parser.position());
+        }
+        quickened += vm.quickened;
+        deoptimized += vm.deoptimized;
+    }
 
-    if (parser.DEBUG_MODE) {
-        cout << endl << "Evaluating file:" << endl;
-        cout << "-------------------------------" << endl;
-        cout << fileContent << endl;
-        cout << "-------------------------------" << endl << endl;
+    int interpret() {
+        AST* tree = STREAM ? nullptr : prepare();
+        if (parser.DEBUG_MODE) {
+            cout << endl << "Program output:" << endl;
+            cout << "-------------------------------" << endl;
+            STREAM ? stream() : run(tree);
+            out->flush();
+            cout << "-------------------------------" << endl << endl;
+        } else STREAM ? stream() : run(tree);
+        if (STATS_MODE || MEMOIZE) print_stats();
+        return 0;
     }
+};
 
-    interpreter.interpret();
-    return 0;
-}
\ No newline at end of file
+#endif
@@ -0,0 +1,200 @@
+#ifndef LEXER_CPP
+#define LEXER_CPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "scanner.cpp"
+#include "token.cpp"
+
+using namespace std;
+
+/* Every token of a file, scanned ahead of parsing and stored as parallel arrays, so the Parser walks it by
+   index instead of pulling tokens from a Scanner one at a time.
+
+   The file is scanned on several threads at once. It is cut into chunks at line starts, which is sound
+   because every token, string and # comment ends at its line; only a """ comment can run across lines.
+   Each chunk is scanned on the assumption that it does not start inside one. The chunks are then joined
+   in order, and a chunk that turns out to start inside a comment left open by the one before it is
+   scanned again from inside the comment. */
+class TokenBuffer {
+  private:
+    /* Chunks smaller than this are not worth a thread */
+    static const size_t MIN_CHUNK_SIZE = 64 << 10;
+    /* Marks where scanning failed; reading it raises the Scanner's error */
+    static const uint8_t INVALID_TOKEN = 0xff;
+
+    /* The tokens of one chunk, with lines and offsets counted from its start */
+    struct Chunk {
+        size_t begin = 0;
+        size_t end = 0;
+        size_t newlines = 0;
+        bool ends_in_comment = false;
+        string error;
+        vector<uint8_t> types;
+        vector<uint32_t> offsets;
+        vector<uint32_t> lengths;
+        vector<Symbol> symbols;
+        vector<int> lines;
+        vector<int> columns;
+    };
+
+    const char* text = nullptr;
+    size_t text_length = 0;
+    string error;
+
+    /* Token type, where the lexeme starts in the source and how long it is (for an INDENT, the indent
+       level), the interned name of an identifier or -1, and the position reported for the token.
+       Tokens that are not in the source, like the END_LINE ending a file without a final newline and
+       the EOF_TOKEN, are given the source size as their offset */
+    vector<uint8_t> types;
+    vector<uint32_t> offsets;
+    vector<uint32_t> lengths;
+    vector<Symbol> symbols;
+    vector<int> lines;
+    vector<int> columns;
+
+    static void scan_chunk(const char* text, Chunk& chunk, bool last, bool resume_comment) {
+        Chunk fresh;
+        fresh.begin = chunk.begin;
+        fresh.end = chunk.end;
+        chunk = move(fresh);
+        chunk.newlines = count(text + chunk.begin, text + chunk.end, '\n');
+        const char* start = text + chunk.begin;
+        size_t length = chunk.end - chunk.begin;
+        Scanner scanner(start, length);
+        try {
+            if (resume_comment) scanner.resume_comment();
+            for (;;) {
+                Token token = scanner.get_next_token();
+                if (token.type == Token::EOF_TOKEN) break;
+                /* A chunk that ends inside a comment has not reached the end of its line */
+                if (!last && scanner.in_comment && token.type == Token::END_LINE && scanner.pos >= length) break;
+                bool in_source = token.start >= start && token.start < start + length;
+                chunk.types.push_back(token.type);
+                chunk.offsets.push_back(in_source ? token.start - start : length);
+                chunk.lengths.push_back(token.length);
+                chunk.symbols.push_back(token.symbol);
+                chunk.lines.push_back(token.line);
+                chunk.columns.push_back(token.column);
+            }
+        } catch (const exception& failure) {
+            chunk.error = failure.what();
+        }
+        chunk.ends_in_comment = scanner.in_comment;
+    }
+
+    /* Cuts the text into up to jobs chunks, each ending just after a newline but the last */
+    vector<Chunk> split(size_t jobs) const {
+        size_t count = max((size_t) 1, min(jobs, text_length / MIN_CHUNK_SIZE));
+        vector<Chunk> chunks;
+        size_t begin = 0;
+        for (size_t i = 1; i < count && begin < text_length; i++) {
+            size_t target = max(begin, text_length / count * i);
+            const char* newline = (const char*) memchr(text + target, '\n', text_length - target);
+            if (newline == nullptr) break;
+            Chunk chunk;
+            chunk.begin = begin;
+            chunk.end = newline - text + 1;
+            chunks.push_back(move(chunk));
+            begin = chunks.back().end;
+        }
+        Chunk last;
+        last.begin = begin;
+        last.end = text_length;
+        chunks.push_back(move(last));
+        return chunks;
+    }
+
+    /* Appends a chunk whose first line is line first_line of the file */
+    void append(const Chunk& chunk, int first_line) {
+        for (size_t i = 0; i < chunk.types.size(); i++) {
+            types.push_back(chunk.types[i]);
+            bool in_source = chunk.offsets[i] < chunk.end - chunk.begin;
+            offsets.push_back(in_source ? chunk.begin + chunk.offsets[i] : text_length);
+            lengths.push_back(chunk.lengths[i]);
+            symbols.push_back(chunk.symbols[i]);
+            lines.push_back(chunk.lines[i] == 0 ? 0 : chunk.lines[i] + first_line - 1);
+            columns.push_back(chunk.columns[i]);
+        }
+    }
+
+    void push_end(uint8_t type) {
+        types.push_back(type);
+        offsets.push_back(text_length);
+        lengths.push_back(0);
+        symbols.push_back(-1);
+        lines.push_back(0);
+        columns.push_back(0);
+    }
+
+  public:
+    /* Chunks the file was scanned in, one thread each */
+    size_t chunk_count = 0;
+    /* Chunks scanned a second time because they started inside a """ comment */
+    size_t rescanned = 0;
+
+    /* Offsets are 32 bits, so larger sources are scanned one token at a time instead */
+    static bool fits(size_t length) { return length < UINT32_MAX; }
+
+    /* Scans text on up to jobs threads. Afterwards the buffer ends with an EOF_TOKEN, or with a mark
+       where the Scanner failed */
+    void scan(const char* source, size_t length, size_t jobs) {
+        text = source;
+        text_length = length;
+        vector<Chunk> chunks = split(max((size_t) 1, jobs));
+        chunk_count = chunks.size();
+        if (chunks.size() == 1) {
+            scan_chunk(text, chunks[0], true, false);
+        } else {
+            vector<thread> workers;
+            for (size_t i = 0; i < chunks.size(); i++) {
+                workers.push_back(thread(&TokenBuffer::scan_chunk, text, ref(chunks[i]), i + 1 == chunks.size(), false));
+            }
+            for (thread& worker : workers) worker.join();
+        }
+
+        types.clear();
+        offsets.clear();
+        lengths.clear();
+        symbols.clear();
+        lines.clear();
+        columns.clear();
+        int first_line = 1;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (i > 0 && chunks[i - 1].ends_in_comment) {
+                scan_chunk(text, chunks[i], i + 1 == chunks.size(), true);
+                rescanned++;
+            }
+            append(chunks[i], first_line);
+            if (!chunks[i].error.empty()) {
+                error = chunks[i].error;
+                push_end(INVALID_TOKEN);
+                return;
+            }
+            first_line += chunks[i].newlines;
+        }
+        push_end(Token::EOF_TOKEN);
+    }
+
+    size_t size() const { return types.size(); }
+
+    /* The token at index i, as the Scanner would have returned it */
+    Token token(size_t i) const {
+        if (types[i] == INVALID_TOKEN) throw runtime_error(error);
+        Token::TokenType type = (Token::TokenType) types[i];
+        Token token;
+        if (offsets[i] < text_length) token = Token(type, text + offsets[i], lengths[i], symbols[i]);
+        else if (type == Token::END_LINE) token = Token(type, "\n", 1);
+        else token.type = type;
+        token.line = lines[i];
+        token.column = columns[i];
+        return token;
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "batch.cpp"
+#include "cache.cpp"
+#include "interpreter.cpp"
+#include "output.cpp"
+#include "parser.cpp"
+#include "profiler.cpp"
+#include "scanner.cpp"
+#include "server.cpp"
+#include "source.cpp"
+#include "transpiler.cpp"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    string filePath = "";
+    bool tree_mode = false;
+    bool debug_mode = false;
+    bool optimize = true;
+    bool stats_mode = false;
+    bool memoize = false;
+    bool quicken = true;
+    bool use_cache = false;
+    bool stream = false;
+    bool lazy = false;
+    string cache_directory = "";
+    string batch_path = "";
+    string serve_path = "";
+    string emit_path = "";
+    size_t jobs = 0;
+    size_t lex_jobs = 0;
+    string profile_path = "";
+    size_t recursion_limit = DEFAULT_RECURSION_LIMIT;
+    bool bad_args = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--tree") tree_mode = true;
+        else if (arg == "--debug") debug_mode = true;
+        else if (arg == "--no-optimize") optimize = false;
+        else if (arg == "--stats") stats_mode = true;
+        else if (arg == "--memoize") memoize = true;
+        else if (arg == "--no-quicken") quicken = false;
+        else if (arg == "--stream") stream = true;
+        else if (arg == "--lazy") lazy = true;
+        else if (arg == "--cache") use_cache = true;
+        else if (arg == "--cache-dir" && i + 1 < argc) {
+            use_cache = true;
+            cache_directory = argv[++i];
+        }
+        else if (arg == "--profile" && i + 1 < argc) profile_path = argv[++i];
+        else if (arg == "--batch" && i + 1 < argc) batch_path = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc) serve_path = argv[++i];
+        else if (arg == "--emit-cpp" && i + 1 < argc) emit_path = argv[++i];
+        else if (arg == "--jobs" && i + 1 < argc) jobs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--lex-jobs" && i + 1 < argc) lex_jobs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--recursion-limit" && i + 1 < argc) recursion_limit = strtoul(argv[++i], nullptr, 10);
+        else if (filePath.empty() && arg[0] != '-') filePath = arg;
+        else bad_args = true;
+    }
+    if (bad_args || (serve_path.empty() && filePath.empty() == batch_path.empty())) {
+        cerr << "Usage: " << argv[0] << " [--tree] [--debug] [--no-optimize] [--stats] [--memoize] [--no-quicken] [--stream] [--lazy] [--lex-jobs N] [--recursion-limit N] [--cache] [--cache-dir DIR] [--profile FILE] <file_path>" << endl;
+        cerr << "       " << argv[0] << " [--no-optimize] [--recursion-limit N] --emit-cpp <output.cpp> <file_path>" << endl;
+        cerr << "       " << argv[0] << " [--tree] [--no-optimize] [--memoize] [--recursion-limit N] [--jobs N] --batch <directory_or_manifest>" << endl;
+        cerr << "       " << argv[0] << " [--jobs N] --serve <socket_path>" << endl;
+        return 1;
+    }
+
+    if (!serve_path.empty()) {
+#ifndef _WIN32
+        ScriptServer server;
+        if (jobs > 0) server.JOBS = jobs;
+        return server.serve(serve_path);
+#else
+        cerr << "Error: --serve needs Unix domain sockets" << endl;
+        return 1;
+#endif
+    }
+
+    if (!batch_path.empty()) {
+        BatchRunner batch;
+        batch.TREE_MODE = tree_mode;
+        batch.OPTIMIZE = optimize;
+        batch.MEMOIZE = memoize;
+        batch.RECURSION_LIMIT = recursion_limit;
+        if (jobs > 0) batch.JOBS = jobs;
+        if (!batch.add_path(batch_path)) {
+            cerr << "Error: Unable to open " << batch_path << endl;
+            return 1;
+        }
+        return batch.run();
+    }
+
+    SourceFile source;
+    if (!source.open(filePath)) {
+        cerr << "Error: Unable to open file " << filePath << endl;
+        return 1;
+    }
+
+    Scanner scanner(source.data(), source.size());
+    Parser parser(scanner);
+    parser.DEBUG_MODE = debug_mode;
+    parser.LEX_JOBS = lex_jobs;
+    /* Memoization and the AST cache work on whole function bodies, so they parse every one up front */
+    parser.LAZY = lazy && !memoize && !use_cache;
+    Interpreter interpreter(parser);
+    interpreter.TREE_MODE = tree_mode;
+    interpreter.OPTIMIZE = optimize;
+    interpreter.STATS_MODE = stats_mode;
+    interpreter.MEMOIZE = memoize;
+    interpreter.QUICKEN = quicken;
+    /* Streaming runs each statement as soon as it is parsed, so nothing that needs the whole tree applies.
+       Options that were asked for are reported as ignored; the optimizer is on by default, so it is not */
+    if (stream) {
+        if (memoize) cerr << "Warning: --memoize is ignored with --stream" << endl;
+        if (lazy) cerr << "Warning: --lazy is ignored with --stream" << endl;
+        if (lex_jobs > 0) cerr << "Warning: --lex-jobs is ignored with --stream" << endl;
+        if (use_cache) cerr << "Warning: " << (cache_directory.empty() ? "--cache" : "--cache-dir") << " is ignored with --stream" << endl;
+        interpreter.STREAM = true;
+        interpreter.OPTIMIZE = false;
+        interpreter.MEMOIZE = false;
+        interpreter.source = &source;
+        parser.LEX_JOBS = 0;
+        parser.LAZY = false;
+        use_cache = false;
+    }
+    AstCache cache(filePath, source.data(), source.size(), cache_directory);
+    if (use_cache) interpreter.cache = &cache;
+    interpreter.RECURSION_LIMIT = recursion_limit;
+    Profiler profiler(source.data(), source.size());
+    if (!profile_path.empty()) interpreter.profiler = &profiler;
+
+    if (parser.DEBUG_MODE) {
+        cout << endl << "Evaluating file:" << endl;
+        cout << "-------------------------------" << endl;
+        cout.write(source.data(), source.size());
+        cout << endl;
+        cout << "-------------------------------" << endl << endl;
+    }
+
+    /* The C++ backend needs every function body, and writes the program instead of running it */
+    if (!emit_path.empty()) {
+        parser.LAZY = false;
+        try {
+            AST* tree = interpreter.prepare();
+            Transpiler transpiler(interpreter.global_names());
+            transpiler.RECURSION_LIMIT = recursion_limit;
+            ofstream emitted(emit_path);
+            if (!emitted.is_open()) {
+                cerr << "Error: Unable to write " << emit_path << endl;
+                return 1;
+            }
+            transpiler.emit(tree, emitted);
+        } catch (const exception& error) {
+            cerr << error.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    int status = 0;
+    try {
+        interpreter.interpret();
+    } catch (const exception& error) {
+        output().flush();
+        cerr << error.what() << endl;
+        status = 1;
+    }
+
+    /* The profile covers a program that stopped with an error too, up to the point where it stopped */
+    if (!profile_path.empty()) {
+        output().flush();
+        profiler.finish();
+        ofstream collapsed(profile_path);
+        if (!collapsed.is_open()) {
+            cerr << "Error: Unable to write profile to " << profile_path << endl;
+            return 1;
+        }
+        profiler.write_collapsed(collapsed);
+        profiler.write_summary(cerr);
+    }
+    return status;
+}
\ No newline at end of file
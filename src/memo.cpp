@@ -0,0 +1,224 @@
+#ifndef MEMO_CPP
+#define MEMO_CPP
+
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ast.cpp"
+#include "value.cpp"
+
+using namespace std;
+
+struct MemoKeyHash {
+    size_t operator()(const vector<Value>& args) const {
+        size_t h = args.size();
+        for (const Value& value : args) {
+            size_t part = value.type;
+            if (value.type == Value::INT)           part = hash<int64_t>()(value.integer);
+            else if (value.type == Value::BOOL)     part = value.boolean;
+            else if (value.type == Value::STRING)   part = value.str->hash();
+            else if (value.type == Value::BIGINT)   part = value.big->hash();
+            else if (value.type == Value::FUNCTION) part = hash<void*>()(value.closure);
+            h = h * 31 + part;
+        }
+        return h;
+    }
+};
+
+struct MemoKeyEqual {
+    bool operator()(const vector<Value>& a, const vector<Value>& b) const {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].type != b[i].type) return false;
+            switch (a[i].type) {
+                case Value::INT:      if (a[i].integer != b[i].integer) return false; break;
+                case Value::BOOL:     if (a[i].boolean != b[i].boolean) return false; break;
+                case Value::STRING:   if (!StringObject::equal(a[i].str, b[i].str)) return false; break;
+                case Value::FUNCTION: if (a[i].closure != b[i].closure) return false; break;
+                case Value::BIGINT:   if (BigInt::compare(*a[i].big, *b[i].big) != 0) return false; break;
+                default:              break;
+            }
+        }
+        return true;
+    }
+};
+
+/* Results of one pure function, keyed by its argument values */
+class MemoTable {
+  private:
+    unordered_map<vector<Value>, Value, MemoKeyHash, MemoKeyEqual> results;
+
+  public:
+    long long hits = 0;
+    long long misses = 0;
+
+    const Value* lookup(const vector<Value>& args) {
+        auto found = results.find(args);
+        if (found == results.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        return &found->second;
+    }
+
+    void insert(vector<Value> args, const Value& result) {
+        results.emplace(move(args), result);
+    }
+
+    size_t size() const { return results.size(); }
+};
+
+/* Finds the user functions whose result depends only on their arguments and gives each one a MemoTable.
+   A function qualifies when it does not print, reads no variable outside its own frame, defines no
+   nested functions, and only calls names that are bound once, by a def of another qualifying function. */
+class PurityAnalysis {
+  private:
+    /* A slot is identified by the function whose frame holds it (nullptr for the module) and its index */
+    typedef pair<FunctionNode*, int> Slot;
+
+    /* The defs bound to each slot, or nullptr entries for anything else bound to it */
+    map<Slot, vector<FunctionNode*>> bindings;
+    map<FunctionNode*, set<FunctionNode*>> callees;
+    set<FunctionNode*> candidates;
+    vector<FunctionNode*> enclosing;
+
+    FunctionNode* owner(int depth) {
+        if (depth == GLOBAL_DEPTH) return nullptr;
+        return enclosing[enclosing.size() - 1 - depth];
+    }
+
+    void collect_bindings(AST* node_) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) collect_bindings(child);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (AST* body : node->bodies) collect_bindings(body);
+            collect_bindings(node->else_body);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            collect_bindings(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            bindings[Slot(owner(node->variable->depth), node->variable->slot)].push_back(nullptr);
+            collect_bindings(node->body);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            bindings[Slot(owner(node->left->depth), node->left->slot)].push_back(nullptr);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            bindings[Slot(owner(node->depth), node->slot)].push_back(node);
+            enclosing.push_back(node);
+            for (int i = 0; i < node->get_num_parameters(); i++) bindings[Slot(node, i)].push_back(nullptr);
+            collect_bindings(node->function_body);
+            enclosing.pop_back();
+        }
+    }
+
+    /* Checks one function body; returns false as soon as something impure is found */
+    bool check(AST* node_, FunctionNode* function) {
+        if (node_ == nullptr) return true;
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) {
+                if (!check(child, function)) return false;
+            }
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                if (!check(node->conditions[i], function) || !check(node->bodies[i], function)) return false;
+            }
+            return check(node->else_body, function);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            return check(node->condition, function) && check(node->body, function);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            return node->variable->depth == 0 && check(node->start, function) && check(node->stop, function)
+                && check(node->step, function) && check(node->body, function);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            return node->left->depth == 0 && check(node->right, function);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            return check(node->value, function);
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            return node->depth == 0;
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            return check(node->left, function) && check(node->right, function);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            return check(node->expr, function);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            if (node->id == PRINT_SYMBOL) return false;
+            const vector<FunctionNode*>& bound = bindings[Slot(owner(node->depth), node->slot)];
+            if (bound.size() != 1 || bound[0] == nullptr) return false;
+            callees[function].insert(bound[0]);
+            for (AST* parameter : node->parameters) {
+                if (!check(parameter, function)) return false;
+            }
+        } else if (dynamic_cast<FunctionNode*>(node_)) {
+            return false;
+        }
+        return true;
+    }
+
+    void find_candidates(AST* node_) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) find_candidates(child);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (AST* body : node->bodies) find_candidates(body);
+            find_candidates(node->else_body);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            find_candidates(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            find_candidates(node->body);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            enclosing.push_back(node);
+            if (check(node->function_body, node)) candidates.insert(node);
+            find_candidates(node->function_body);
+            enclosing.pop_back();
+        }
+    }
+
+  public:
+    vector<MemoTable*> tables;
+
+    PurityAnalysis() {}
+    PurityAnalysis(const PurityAnalysis&) = delete;
+    ~PurityAnalysis() {
+        for (MemoTable* table : tables) delete table;
+    }
+
+    void analyze(AST* tree) {
+        collect_bindings(tree);
+        find_candidates(tree);
+
+        /* Drop candidates that call a function which is not pure, until nothing changes */
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto it = candidates.begin(); it != candidates.end();) {
+                bool pure = true;
+                for (FunctionNode* callee : callees[*it]) {
+                    if (candidates.count(callee) == 0) pure = false;
+                }
+                if (pure) ++it;
+                else {
+                    it = candidates.erase(it);
+                    changed = true;
+                }
+            }
+        }
+
+        for (FunctionNode* function : candidates) {
+            function->memo = new MemoTable();
+            tables.push_back(function->memo);
+        }
+    }
+
+    long long hits() const {
+        long long total = 0;
+        for (MemoTable* table : tables) total += table->hits;
+        return total;
+    }
+
+    long long misses() const {
+        long long total = 0;
+        for (MemoTable* table : tables) total += table->misses;
+        return total;
+    }
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef OPERATIONS_CPP
+#define OPERATIONS_CPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "bigint.cpp"
+#include "token.cpp"
+#include "value.cpp"
+
+using namespace std;
+
+/* Operator semantics shared by the tree walker and the bytecode VM */
+
+/* Handles boolean operations */
+inline Value compute_BoolOp(const Value& first, Token::TokenType op, const Value* second = nullptr) {
+    /* Unary operations */
+    bool val1 = first.boolean;
+    if (second == nullptr) {
+        if (op == Token::NOT) return Value::make_bool(!val1);
+        throw runtime_error("Invalid operation");
+    }
+
+    /* Binary operations */
+    bool val2 = second->boolean;
+    if (op == Token::OR)         return Value::make_bool(val1 || val2);
+    if (op == Token::AND)        return Value::make_bool(val1 && val2);
+    if (op == Token::EQUALS)     return Value::make_bool(val1 == val2);
+    if (op == Token::NOT_EQUALS) return Value::make_bool(val1 != val2);
+    throw runtime_error("Invalid operation");
+}
+
+/* Machine-word arithmetic that reports overflow instead of wrapping */
+inline bool add_overflows(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return __builtin_add_overflow(a, b, result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return true;
+    *result = a + b;
+    return false;
+#endif
+}
+
+inline bool subtract_overflows(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return __builtin_sub_overflow(a, b, result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return true;
+    *result = a - b;
+    return false;
+#endif
+}
+
+inline bool multiply_overflows(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return __builtin_mul_overflow(a, b, result);
+#else
+    if (a == -1 || b == -1) {
+        int64_t other = a == -1 ? b : a;
+        if (other == INT64_MIN) return true;
+        *result = -other;
+        return false;
+    }
+    int64_t product = (int64_t) ((uint64_t) a * (uint64_t) b);
+    if (a != 0 && product / a != b) return true;
+    *result = product;
+    return false;
+#endif
+}
+
+/* The BigInt an integer operand holds, or one built from its machine word in temporary */
+inline const BigInt& as_BigInt(const Value& value, BigInt& temporary) {
+    if (value.type == Value::BIGINT) return *value.big;
+    temporary = BigInt::from_int64(value.integer);
+    return temporary;
+}
+
+/* Back to an inline integer whenever the result fits one */
+inline Value integer_result(BigInt&& result) {
+    if (result.fits_int64()) return Value::make_int(result.to_int64());
+    return Value::make_big(new BigInt(move(result)));
+}
+
+/* Integer operations where an operand or the result does not fit a machine word */
+inline Value compute_BigIntOp(const Value& first, Token::TokenType op, const Value& second) {
+    if (op == Token::DIVIDE && second.type == Value::INT && second.integer == 0)
+        throw runtime_error("ZeroDivisionError: division by zero");
+    BigInt first_temporary, second_temporary;
+    const BigInt& a = as_BigInt(first, first_temporary);
+    const BigInt& b = as_BigInt(second, second_temporary);
+    if (op == Token::PLUS)   return integer_result(BigInt::add(a, b));
+    if (op == Token::MINUS)  return integer_result(BigInt::subtract(a, b));
+    if (op == Token::TIMES)  return integer_result(BigInt::multiply(a, b));
+    if (op == Token::DIVIDE) return integer_result(BigInt::divide(a, b));
+    int order = BigInt::compare(a, b);
+    if (op == Token::EQUALS)              return Value::make_bool(order == 0);
+    if (op == Token::NOT_EQUALS)          return Value::make_bool(order != 0);
+    if (op == Token::LESS_THAN)           return Value::make_bool(order <  0);
+    if (op == Token::GREATER_THAN)        return Value::make_bool(order >  0);
+    if (op == Token::LESS_THAN_EQUALS)    return Value::make_bool(order <= 0);
+    if (op == Token::GREATER_THAN_EQUALS) return Value::make_bool(order >= 0);
+    throw runtime_error("Invalid operation");
+}
+
+/* Handles integer operations. Operands that fit a machine word are computed on directly, and a result
+   that overflows one is computed again as a BigInt */
+inline Value compute_IntOp(const Value& first, Token::TokenType op, const Value* second = nullptr) {
+    /* Unary operations */
+    if (second == nullptr) {
+        if (op == Token::PLUS) return first;
+        if (op == Token::MINUS) {
+            if (first.type == Value::INT && first.integer != INT64_MIN) return Value::make_int(-first.integer);
+            return compute_BigIntOp(Value::make_int(0), Token::MINUS, first);
+        }
+        throw runtime_error("Invalid operation");
+    }
+
+    /* Binary operations */
+    if (first.type != Value::INT || second->type != Value::INT) return compute_BigIntOp(first, op, *second);
+    int64_t val1 = first.integer;
+    int64_t val2 = second->integer;
+    int64_t result;
+    if (op == Token::PLUS)  return add_overflows(val1, val2, &result) ? compute_BigIntOp(first, op, *second) : Value::make_int(result);
+    if (op == Token::MINUS) return subtract_overflows(val1, val2, &result) ? compute_BigIntOp(first, op, *second) : Value::make_int(result);
+    if (op == Token::TIMES) return multiply_overflows(val1, val2, &result) ? compute_BigIntOp(first, op, *second) : Value::make_int(result);
+    if (op == Token::DIVIDE) {
+        if (val2 == 0) throw runtime_error("ZeroDivisionError: division by zero");
+        if (val1 == INT64_MIN && val2 == -1) return compute_BigIntOp(first, op, *second);
+        return Value::make_int(val1 / val2);
+    }
+    if (op == Token::EQUALS)              return Value::make_bool(val1 == val2);
+    if (op == Token::NOT_EQUALS)          return Value::make_bool(val1 != val2);
+    if (op == Token::LESS_THAN)           return Value::make_bool(val1 <  val2);
+    if (op == Token::GREATER_THAN)        return Value::make_bool(val1 >  val2);
+    if (op == Token::LESS_THAN_EQUALS)    return Value::make_bool(val1 <= val2);
+    if (op == Token::GREATER_THAN_EQUALS) return Value::make_bool(val1 >= val2);
+    throw runtime_error("Invalid operation");
+}
+
+/* Handles string operations */
+inline Value compute_StringOp(const Value& first, Token::TokenType op, const Value& second) {
+    if (op == Token::PLUS)                return Value::make_string(StringObject::concat(first.str, second.str));
+    if (op == Token::EQUALS)              return Value::make_bool(StringObject::equal(first.str, second.str));
+    if (op == Token::NOT_EQUALS)          return Value::make_bool(!StringObject::equal(first.str, second.str));
+    const string& text1 = first.text();
+    const string& text2 = second.text();
+    if (op == Token::LESS_THAN)           return Value::make_bool(text1 <  text2);
+    if (op == Token::GREATER_THAN)        return Value::make_bool(text1 >  text2);
+    if (op == Token::LESS_THAN_EQUALS)    return Value::make_bool(text1 <= text2);
+    if (op == Token::GREATER_THAN_EQUALS) return Value::make_bool(text1 >= text2);
+    throw runtime_error("Invalid operation");
+}
+
+/* Handles two-operand operations on already evaluated operands */
+inline Value compute_BinaryOp(const Value& left, Token::TokenType op, const Value& right) {
+    if (left.is_integer() && right.is_integer()) return compute_IntOp(left, op, &right);
+    if (left.type != right.type)
+        throw runtime_error("Invalid operand type");
+    if (left.type == Value::BOOL)   return compute_BoolOp(left, op, &right);
+    if (left.type == Value::STRING) return compute_StringOp(left, op, right);
+    throw runtime_error("Invalid operand type");
+}
+
+/* A bound of range(). The loop counts in a machine word, so bounds too large for one are refused */
+inline int64_t range_bound(const Value& value) {
+    if (value.type != Value::INT) throw runtime_error("Invalid range argument");
+    return value.integer;
+}
+
+inline int64_t range_step(const Value& value) {
+    int64_t step = range_bound(value);
+    if (step == 0) throw runtime_error("ValueError: range() arg 3 must not be zero");
+    return step;
+}
+
+/* Whether a range loop whose counter is now at counter runs again */
+inline bool range_continues(int64_t counter, int64_t stop, int64_t step) {
+    return step > 0 ? counter < stop : counter > stop;
+}
+
+/* Moves a range loop's counter to its next value. A counter that would leave the machine word is past any
+   stop, so it is parked on stop, which ends the loop */
+inline void range_advance(int64_t& counter, int64_t stop, int64_t step) {
+    if (add_overflows(counter, step, &counter)) counter = stop;
+}
+
+/* `and` and `or` evaluate their right operand only when the left one does not already decide the result.
+   Both operands must still be booleans */
+inline bool is_short_circuit(Token::TokenType op) {
+    return op == Token::AND || op == Token::OR;
+}
+
+/* Whether the left operand of `and` or `or` is the result, so the right operand is not evaluated */
+inline bool decides_short_circuit(Token::TokenType op, const Value& left) {
+    if (left.type != Value::BOOL) throw runtime_error("Invalid operand type");
+    return left.boolean == (op == Token::OR);
+}
+
+/* The result of `and` or `or` whose left operand did not decide it, which is the right operand */
+inline const Value& short_circuit_result(const Value& right) {
+    if (right.type != Value::BOOL) throw runtime_error("Invalid operand type");
+    return right;
+}
+
+/* Handles one-operand operations on an already evaluated operand */
+inline Value compute_UnaryOp(Token::TokenType op, const Value& value) {
+    if (value.type == Value::BOOL) return compute_BoolOp(value, op);
+    if (value.is_integer()) return compute_IntOp(value, op);
+    throw runtime_error("Invalid operand type");
+}
+
+/* Forms an operator site can be quickened into, one per operand type and operator. A site starts out
+   UNSEEN, takes the form that matches the operands of its first execution, and becomes GENERIC for good
+   the first time its operands no longer match */
+enum QuickOp : unsigned char {
+    QUICK_UNSEEN, QUICK_GENERIC,
+    INT_ADD, INT_SUB, INT_MUL, INT_DIV, INT_EQ, INT_NE, INT_LT, INT_GT, INT_LE, INT_GE,
+    STRING_ADD, STRING_EQ, STRING_NE, STRING_LT, STRING_GT, STRING_LE, STRING_GE,
+    BOOL_EQ, BOOL_NE,
+    INT_POS, INT_NEG, BOOL_NOT
+};
+
+/* The type both operands must have for a quickened form to apply */
+inline Value::Type quick_operand_type(QuickOp quick) {
+    if (quick < STRING_ADD) return Value::INT;
+    if (quick < BOOL_EQ)    return Value::STRING;
+    if (quick < INT_POS)    return Value::BOOL;
+    if (quick < BOOL_NOT)   return Value::INT;
+    return Value::BOOL;
+}
+
+/* The form of op for these operands, or QUICK_GENERIC when there is none */
+inline QuickOp specialize_BinaryOp(const Value& left, Token::TokenType op, const Value& right) {
+    if (left.type != right.type) return QUICK_GENERIC;
+    if (left.type == Value::INT) {
+        switch (op) {
+            case Token::PLUS:                return INT_ADD;
+            case Token::MINUS:               return INT_SUB;
+            case Token::TIMES:               return INT_MUL;
+            case Token::DIVIDE:              return INT_DIV;
+            case Token::EQUALS:              return INT_EQ;
+            case Token::NOT_EQUALS:          return INT_NE;
+            case Token::LESS_THAN:           return INT_LT;
+            case Token::GREATER_THAN:        return INT_GT;
+            case Token::LESS_THAN_EQUALS:    return INT_LE;
+            case Token::GREATER_THAN_EQUALS: return INT_GE;
+            default:                         return QUICK_GENERIC;
+        }
+    }
+    if (left.type == Value::STRING) {
+        switch (op) {
+            case Token::PLUS:                return STRING_ADD;
+            case Token::EQUALS:              return STRING_EQ;
+            case Token::NOT_EQUALS:          return STRING_NE;
+            case Token::LESS_THAN:           return STRING_LT;
+            case Token::GREATER_THAN:        return STRING_GT;
+            case Token::LESS_THAN_EQUALS:    return STRING_LE;
+            case Token::GREATER_THAN_EQUALS: return STRING_GE;
+            default:                         return QUICK_GENERIC;
+        }
+    }
+    if (left.type == Value::BOOL) {
+        switch (op) {
+            case Token::EQUALS:     return BOOL_EQ;
+            case Token::NOT_EQUALS: return BOOL_NE;
+            default:                return QUICK_GENERIC;
+        }
+    }
+    return QUICK_GENERIC;
+}
+
+inline QuickOp specialize_UnaryOp(Token::TokenType op, const Value& value) {
+    if (value.type == Value::INT && op == Token::PLUS)  return INT_POS;
+    if (value.type == Value::INT && op == Token::MINUS) return INT_NEG;
+    if (value.type == Value::BOOL && op == Token::NOT)  return BOOL_NOT;
+    return QUICK_GENERIC;
+}
+
+/* Runs a quickened two-operand form. The caller has checked both operands against quick_operand_type.
+   Arithmetic that overflows, or divides by zero, is left to compute_IntOp */
+inline Value compute_QuickBinary(QuickOp quick, const Value& left, const Value& right) {
+    int64_t result;
+    switch (quick) {
+        case INT_ADD:
+            if (add_overflows(left.integer, right.integer, &result)) return compute_IntOp(left, Token::PLUS, &right);
+            return Value::make_int(result);
+        case INT_SUB:
+            if (subtract_overflows(left.integer, right.integer, &result)) return compute_IntOp(left, Token::MINUS, &right);
+            return Value::make_int(result);
+        case INT_MUL:
+            if (multiply_overflows(left.integer, right.integer, &result)) return compute_IntOp(left, Token::TIMES, &right);
+            return Value::make_int(result);
+        case INT_DIV:
+            if (right.integer == 0 || right.integer == -1) return compute_IntOp(left, Token::DIVIDE, &right);
+            return Value::make_int(left.integer / right.integer);
+        case INT_EQ:     return Value::make_bool(left.integer == right.integer);
+        case INT_NE:     return Value::make_bool(left.integer != right.integer);
+        case INT_LT:     return Value::make_bool(left.integer <  right.integer);
+        case INT_GT:     return Value::make_bool(left.integer >  right.integer);
+        case INT_LE:     return Value::make_bool(left.integer <= right.integer);
+        case INT_GE:     return Value::make_bool(left.integer >= right.integer);
+        case STRING_ADD: return Value::make_string(StringObject::concat(left.str, right.str));
+        case STRING_EQ:  return Value::make_bool(StringObject::equal(left.str, right.str));
+        case STRING_NE:  return Value::make_bool(!StringObject::equal(left.str, right.str));
+        case STRING_LT:  return Value::make_bool(left.text() <  right.text());
+        case STRING_GT:  return Value::make_bool(left.text() >  right.text());
+        case STRING_LE:  return Value::make_bool(left.text() <= right.text());
+        case STRING_GE:  return Value::make_bool(left.text() >= right.text());
+        case BOOL_EQ:    return Value::make_bool(left.boolean == right.boolean);
+        case BOOL_NE:    return Value::make_bool(left.boolean != right.boolean);
+        default:         throw runtime_error("Invalid operation");
+    }
+}
+
+/* Runs a quickened one-operand form. The caller has checked the operand against quick_operand_type */
+inline Value compute_QuickUnary(QuickOp quick, const Value& value) {
+    switch (quick) {
+        case INT_POS:  return value;
+        case INT_NEG:  return compute_IntOp(value, Token::MINUS);
+        case BOOL_NOT: return Value::make_bool(!value.boolean);
+        default:       throw runtime_error("Invalid operation");
+    }
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef OPTIMIZER_CPP
+#define OPTIMIZER_CPP
+
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "arena.cpp"
+#include "ast.cpp"
+#include "operations.cpp"
+
+using namespace std;
+
+/* Runs between the Resolver and execution. Folds constant BinaryOpNode and UnaryOpNode subtrees into
+   literals, as well as `False and x` and `True or x`, propagates variables that are assigned a constant
+   exactly once, and drops the branches of a ConditionalNode and the `while False` loops that can never
+   be taken.
+
+   A variable is propagated only where it is certain to hold its constant: reads later in the same
+   body as its single top-level assignment, and, for globals, reads inside functions when no user
+   function can have been called before the assignment ran. */
+class Optimizer {
+  private:
+    /* A variable is the function whose frame holds it (nullptr for the module) and its slot */
+    typedef pair<FunctionNode*, int> Key;
+
+    Arena& arena;
+    map<Key, int> assignments;
+    map<Key, AST*> known;
+    map<int, AST*> known_globals_in_functions;
+    FunctionNode* current_function = nullptr;
+    bool user_call_seen = false;
+
+  public:
+    int folded = 0;
+    int propagated = 0;
+    int pruned = 0;
+    int nodes_before = 0;
+    int nodes_after = 0;
+
+    Optimizer(Arena& arena) : arena(arena) {}
+
+    AST* optimize(AST* tree) {
+        nodes_before = count_nodes(tree);
+        count_assignments(tree);
+        tree = optimize_body(tree);
+        nodes_after = count_nodes(tree);
+        return tree;
+    }
+
+    /* Optimizes a function body parsed after optimize() ran, with what optimize() learned about the module */
+    void optimize_lazy(FunctionNode* function) {
+        int before = count_nodes(function->function_body);
+        count_assignments(function);
+        optimize_function(function);
+        nodes_before += before;
+        nodes_after += count_nodes(function->function_body);
+    }
+
+    int removed() const { return nodes_before - nodes_after; }
+
+  private:
+    static bool is_literal(AST* node) {
+        return dynamic_cast<IntNode*>(node) || dynamic_cast<BoolNode*>(node) || dynamic_cast<StringNode*>(node);
+    }
+
+    static const Value& literal_value(AST* node) {
+        if (IntNode* literal = dynamic_cast<IntNode*>(node)) return literal->constant;
+        if (BoolNode* literal = dynamic_cast<BoolNode*>(node)) return literal->constant;
+        return static_cast<StringNode*>(node)->constant;
+    }
+
+    AST* make_literal(const Value& value) {
+        if (value.is_integer())        return arena.make<IntNode>(value);
+        if (value.type == Value::BOOL) return arena.make<BoolNode>(value.boolean);
+        return arena.make<StringNode>(value.text());
+    }
+
+    int count_nodes(AST* node_) {
+        if (node_ == nullptr) return 0;
+        int count = 1;
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) count += count_nodes(child);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            count += count_nodes(node->function_body);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            for (AST* parameter : node->parameters) count += count_nodes(parameter);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            count += count_nodes(node->value);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                count += count_nodes(node->conditions[i]) + count_nodes(node->bodies[i]);
+            }
+            count += count_nodes(node->else_body);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            count += count_nodes(node->condition) + count_nodes(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            count += count_nodes(node->variable) + count_nodes(node->start) + count_nodes(node->stop)
+                   + count_nodes(node->step) + count_nodes(node->body);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            count += count_nodes(node->expr);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            count += count_nodes(node->left) + count_nodes(node->right);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            count += count_nodes(node->left) + count_nodes(node->right);
+        }
+        return count;
+    }
+
+    void count_assignments(AST* node_) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) count_assignments(child);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (AST* body : node->bodies) count_assignments(body);
+            count_assignments(node->else_body);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            count_assignments(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            /* The loop variable takes a new value on every pass, so it is never a constant */
+            assignments[Key(current_function, node->variable->slot)] += 2;
+            count_assignments(node->body);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            assignments[Key(current_function, node->left->slot)]++;
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            FunctionNode* enclosing = current_function;
+            current_function = node;
+            count_assignments(node->function_body);
+            current_function = enclosing;
+        }
+    }
+
+    /* Optimizes the statements of the module or of one function body, tracking which variables are known */
+    AST* optimize_body(AST* body) {
+        BlockNode* block = dynamic_cast<BlockNode*>(body);
+        if (block == nullptr) return optimize_statement(body);
+        vector<FunctionNode*> functions;
+        for (AST*& child : block->children) {
+            if (FunctionNode* function = dynamic_cast<FunctionNode*>(child)) {
+                functions.push_back(function);
+                continue;
+            }
+            child = optimize_statement(child);
+            if (current_function == nullptr && contains_user_call(child)) user_call_seen = true;
+            AssignNode* assign = dynamic_cast<AssignNode*>(child);
+            if (assign != nullptr && is_literal(assign->right)) {
+                Key key(current_function, assign->left->slot);
+                if (assignments[key] == 1) {
+                    known[key] = assign->right;
+                    if (current_function == nullptr && !user_call_seen)
+                        known_globals_in_functions[key.second] = assign->right;
+                }
+            }
+        }
+        for (FunctionNode* function : functions) {
+            FunctionNode* enclosing = current_function;
+            current_function = function;
+            function->function_body = static_cast<BlockNode*>(optimize_body(function->function_body));
+            current_function = enclosing;
+        }
+        return block;
+    }
+
+    bool contains_user_call(AST* node_) {
+        if (node_ == nullptr) return false;
+        if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            if (node->id != PRINT_SYMBOL) return true;
+            for (AST* parameter : node->parameters) {
+                if (contains_user_call(parameter)) return true;
+            }
+        } else if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) {
+                if (contains_user_call(child)) return true;
+            }
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                if (contains_user_call(node->conditions[i]) || contains_user_call(node->bodies[i])) return true;
+            }
+            return contains_user_call(node->else_body);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            return contains_user_call(node->condition) || contains_user_call(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            return contains_user_call(node->start) || contains_user_call(node->stop) || contains_user_call(node->step)
+                || contains_user_call(node->body);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            return contains_user_call(node->value);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            return contains_user_call(node->right);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            return contains_user_call(node->left) || contains_user_call(node->right);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            return contains_user_call(node->expr);
+        }
+        return false;
+    }
+
+    AST* optimize_statement(AST* node_) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST*& child : node->children) {
+                if (FunctionNode* function = dynamic_cast<FunctionNode*>(child)) optimize_function(function);
+                else child = optimize_statement(child);
+            }
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            return optimize_Conditional(node);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            node->condition = optimize_expression(node->condition);
+            BoolNode* known_condition = dynamic_cast<BoolNode*>(node->condition);
+            if (known_condition != nullptr && !known_condition->value) {
+                pruned++;
+                return arena.make<NoOp>();
+            }
+            node->body = optimize_statement(node->body);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            node->start = optimize_expression(node->start);
+            node->stop = optimize_expression(node->stop);
+            node->step = optimize_expression(node->step);
+            node->body = optimize_statement(node->body);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            node->right = optimize_expression(node->right);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            node->value = optimize_expression(node->value);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            return optimize_expression(node);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            optimize_function(node);
+        }
+        return node_;
+    }
+
+    /* Drops the branches whose condition is always False. A condition that is always True makes its body
+       the else branch, and the branches after it can never run. With no branch left, the else body is all
+       that remains */
+    AST* optimize_Conditional(ConditionalNode* node) {
+        size_t kept = 0;
+        bool always_taken = false;
+        for (size_t i = 0; i < node->conditions.size() && !always_taken; i++) {
+            AST* condition = optimize_expression(node->conditions[i]);
+            AST* body = optimize_statement(node->bodies[i]);
+            BoolNode* known_condition = dynamic_cast<BoolNode*>(condition);
+            if (known_condition == nullptr) {
+                node->conditions[kept] = condition;
+                node->bodies[kept++] = body;
+                continue;
+            }
+            pruned++;
+            if (known_condition->value) {
+                pruned += node->conditions.size() - i - 1;
+                node->else_body = body;
+                always_taken = true;
+            }
+        }
+        if (!always_taken) node->else_body = optimize_statement(node->else_body);
+        node->conditions.resize(kept);
+        node->bodies.resize(kept);
+        return kept == 0 ? node->else_body : node;
+    }
+
+    /* Function defined inside a conditional or nested block */
+    void optimize_function(FunctionNode* function) {
+        FunctionNode* enclosing = current_function;
+        current_function = function;
+        function->function_body = static_cast<BlockNode*>(optimize_body(function->function_body));
+        current_function = enclosing;
+    }
+
+    AST* optimize_expression(AST* node_) {
+        if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            AST* constant = nullptr;
+            if (node->depth == GLOBAL_DEPTH) {
+                if (current_function == nullptr) {
+                    auto found = known.find(Key(nullptr, node->slot));
+                    if (found != known.end()) constant = found->second;
+                } else {
+                    auto found = known_globals_in_functions.find(node->slot);
+                    if (found != known_globals_in_functions.end()) constant = found->second;
+                }
+            } else if (node->depth == 0) {
+                auto found = known.find(Key(current_function, node->slot));
+                if (found != known.end()) constant = found->second;
+            }
+            if (constant != nullptr) {
+                propagated++;
+                return constant;
+            }
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            for (AST*& parameter : node->parameters) parameter = optimize_expression(parameter);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            node->expr = optimize_expression(node->expr);
+            if (is_literal(node->expr)) return fold(node_, nullptr, node->op.type, node->expr);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            node->left = optimize_expression(node->left);
+            node->right = optimize_expression(node->right);
+            BoolNode* left = dynamic_cast<BoolNode*>(node->left);
+            if (left != nullptr && is_short_circuit(node->op.type) && decides_short_circuit(node->op.type, left->constant)) {
+                folded++;
+                return node->left;
+            }
+            if (is_literal(node->left) && is_literal(node->right)) return fold(node_, node->left, node->op.type, node->right);
+        }
+        return node_;
+    }
+
+    /* Evaluates an operation on literals now. Anything that would fail is left for runtime to report */
+    AST* fold(AST* node, AST* left, Token::TokenType op, AST* right) {
+        const Value& right_value = literal_value(right);
+        if (op == Token::DIVIDE && right_value.type == Value::INT && right_value.integer == 0) return node;
+        try {
+            Value result = left == nullptr ? compute_UnaryOp(op, right_value)
+                                           : compute_BinaryOp(literal_value(left), op, right_value);
+            folded++;
+            AST* literal = make_literal(result);
+            literal->line = node->line;
+            literal->column = node->column;
+            return literal;
+        } catch (const runtime_error&) {
+            return node;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef OUTPUT_CPP
+#define OUTPUT_CPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "value.cpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* Where print writes. Lines are formatted straight into one reusable buffer, which goes out in a single
+   fwrite when it fills and at exit. When the output is a terminal every line is flushed as it ends, so
+   interactive output is not held back. Writing through stdio keeps it in order with anything written to cout.
+   A sink can instead capture into a string, which is how batch mode keeps each script's output apart, or
+   hand each flushed chunk to a function, which is how the server sends output back to its client */
+class OutputSink {
+  private:
+    static const size_t CAPACITY = 64 * 1024;
+
+    char buffer[CAPACITY];
+    size_t used = 0;
+    FILE* file = nullptr;
+    string* capture = nullptr;
+    void (*forward)(void* context, const char* text, size_t length) = nullptr;
+    void* forward_context = nullptr;
+    bool line_buffered = false;
+
+    void reserve(size_t length) {
+        if (used + length > CAPACITY) flush();
+    }
+
+    void deliver(const char* text, size_t length) {
+        if (capture != nullptr) capture->append(text, length);
+        else if (forward != nullptr) forward(forward_context, text, length);
+        else fwrite(text, 1, length, file);
+    }
+
+  public:
+    OutputSink(FILE* file) { redirect(file); }
+    OutputSink(string* capture) : capture(capture) {}
+    OutputSink(void (*forward)(void*, const char*, size_t), void* context) : forward(forward), forward_context(context) {}
+    OutputSink(const OutputSink&) = delete;
+    ~OutputSink() { flush(); }
+
+    /* Flushes what is pending and sends later output to file */
+    void redirect(FILE* target) {
+        flush();
+        file = target;
+#ifndef _WIN32
+        line_buffered = isatty(fileno(file));
+#endif
+    }
+
+    void flush() {
+        if (used == 0) return;
+        deliver(buffer, used);
+        used = 0;
+        if (line_buffered) fflush(file);
+    }
+
+    void write(const char* text, size_t length) {
+        if (length > CAPACITY) {
+            flush();
+            deliver(text, length);
+            return;
+        }
+        reserve(length);
+        memcpy(buffer + used, text, length);
+        used += length;
+    }
+
+    void put(char c) {
+        reserve(1);
+        buffer[used++] = c;
+    }
+
+    /* Writes the digits back to front into a scratch array, then copies them in one go */
+    void write_int(int64_t value) {
+        char digits[20];
+        char* end = digits + sizeof(digits);
+        char* start = end;
+        uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+        do {
+            *--start = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) *--start = '-';
+        write(start, end - start);
+    }
+
+    void write_value(const Value& value) {
+        if (value.type == Value::STRING) {
+            const string& text = value.text();
+            write(text.data(), text.size());
+        } else if (value.type == Value::BOOL) {
+            if (value.boolean) write("True", 4);
+            else write("False", 5);
+        } else if (value.type == Value::INT) {
+            write_int(value.integer);
+        } else if (value.type == Value::BIGINT) {
+            string digits = value.big->to_decimal();
+            write(digits.data(), digits.size());
+        }
+    }
+
+    void end_line() {
+        put('\n');
+        if (line_buffered) flush();
+    }
+
+    /* One print call: the values separated by spaces, then a newline */
+    void print(const Value* values, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) put(' ');
+            write_value(values[i]);
+        }
+        end_line();
+    }
+};
+
+/* The sink for the program's standard output */
+inline OutputSink& output() {
+    static OutputSink sink(stdout);
+    return sink;
+}
+
+#endif
@@ -4,40 +4,86 @@
 #include <iostream>
 #include <stack>
 #include <stdexcept>
+#include "arena.cpp"
 #include "ast.cpp"
+#include "bigint.cpp"
+#include "lexer.cpp"
+#include "operations.cpp"
 #include "scanner.cpp"
 #include "token.cpp"
 
 class Parser {
     
   private:
-    Scanner scanner;
+    Scanner& scanner;
     Token current_token;
     stack<int> indent_level;
     int debug_depth = 0;
+    int stream_indent = 0;
+    bool stream_started = false;
+    /* Set when program() scanned the whole file up front; next_token indexes tokens */
+    bool buffered = false;
+    size_t next_token = 0;
 
 
   public:
     bool DEBUG_MODE = false;
-    Parser(Scanner &_) : scanner(_), current_token(scanner.get_next_token()) {
+    /* When above 0, program() scans the file on up to this many threads before parsing it */
+    size_t LEX_JOBS = 0;
+    /* Skim function bodies instead of parsing them; each is parsed by parse_body() on its first call */
+    bool LAZY = false;
+    /* Bodies skimmed so far, counting those skimmed inside bodies parsed later */
+    size_t skimmed = 0;
+    TokenBuffer tokens;
+    Arena arena;
+    /* The first token is read by program(), so a Parser whose tree comes from elsewhere never scans */
+    Parser(Scanner &_) : scanner(_) {
         indent_level.push(0);
     }
+    Parser(const Parser&) = delete;
 
     void error() {
         throw runtime_error("Invalid syntax");
     }
 
+    /* The token after current_token. Past the end of the buffer, the final EOF_TOKEN repeats, as the Scanner's does */
+    Token read_token() {
+        if (!buffered) return scanner.get_next_token();
+        Token token = tokens.token(next_token);
+        if (next_token + 1 < tokens.size()) next_token++;
+        return token;
+    }
+
     void eat(Token::TokenType type) {
         if (current_token.type == type) {
-            current_token = scanner.get_next_token();
+            current_token = read_token();
         } else {
             error();
         }
     }
 
+    /* Records the source position of the token a node starts at */
+    template <typename T>
+    T* at(const Token& token, T* node) {
+        node->line = token.line;
+        node->column = token.column;
+        return node;
+    }
+
+    /* Value of an INT token, read straight from the source buffer. Literals of more than 18 digits
+       may not fit a machine word, and are parsed as a BigInt */
+    Value integer_value(const Token& token) {
+        if (token.length > 18) return integer_result(BigInt::from_decimal(token.start, token.length));
+        int64_t value = 0;
+        for (int i = 0; i < token.length; i++) {
+            value = value * 10 + (token.start[i] - '0');
+        }
+        return Value::make_int(value);
+    }
+
     void parse_indent() {
         if (current_token.type == Token::INDENT) {
-            int n = stoi(current_token.value);
+            int n = current_token.length;
             if (n >  indent_level.top()) indent(n);
             if (n <  indent_level.top()) unindent(n);
             if (n == indent_level.top()) return;
@@ -59,22 +105,22 @@ class Parser {
         AST* node;
         if (token.type == Token::NOT) {
             eat(Token::NOT);
-            node = new UnaryOpNode(token, factor());
+            node = at(token, arena.make<UnaryOpNode>(token, factor()));
         } else if (token.type == Token::PLUS) {
             eat(Token::PLUS);
-            node = new UnaryOpNode(token, factor());
+            node = at(token, arena.make<UnaryOpNode>(token, factor()));
         } else if (token.type == Token::MINUS) {
             eat(Token::MINUS);
-            node = new UnaryOpNode(token, factor());
+            node = at(token, arena.make<UnaryOpNode>(token, factor()));
         } else if (token.type == Token::STRING) {
             eat(Token::STRING);
-            node = new StringNode(token.value);
+            node = at(token, arena.make<StringNode>(token.value()));
         } else if (token.type == Token::BOOL) {
             eat(Token::BOOL);
-            node = new BoolNode(token.value == "True");
+            node = at(token, arena.make<BoolNode>(token.start[0] == 'T'));
         } else if (token.type == Token::INT) {
             eat(Token::INT);
-            node = new IntNode(stoi(token.value));
+            node = at(token, arena.make<IntNode>(integer_value(token)));
         } else if (token.type == Token::L_PAREN) {
             eat(Token::L_PAREN);
             node = logic_expr();
@@ -85,7 +131,7 @@ class Parser {
             //node = new FunctionCallNode(token.value);
         } else {
             eat(Token::VARIABLE_ID);
-            node = new VariableNode(token.value);
+            node = at(token, arena.make<VariableNode>(token.symbol));
         }
         debugPrint("</factor>");
         return node;
@@ -97,7 +143,7 @@ class Parser {
         while (current_token.type == Token::TIMES || current_token.type == Token::DIVIDE) {
             Token operator_token = current_token;
             eat(operator_token.type);
-            node = new BinaryOpNode(node, operator_token, factor());
+            node = at(operator_token, arena.make<BinaryOpNode>(node, operator_token, factor()));
         }
         debugPrint("</term>");
         return node;
@@ -109,7 +155,7 @@ class Parser {
         while (current_token.type == Token::PLUS || current_token.type == Token::MINUS) {
             Token operator_token = current_token;
             eat(operator_token.type);
-            node = new BinaryOpNode(node, operator_token, term());
+            node = at(operator_token, arena.make<BinaryOpNode>(node, operator_token, term()));
         }
         debugPrint("</math_expr>");
         return node;
@@ -129,7 +175,7 @@ class Parser {
             Token operator_token = current_token;
             eat(operator_token.type);
             //node = new BinaryOpNode(node, operator_token, expr());?
-            node = new BinaryOpNode(node, operator_token, math_expr());
+            node = at(operator_token, arena.make<BinaryOpNode>(node, operator_token, math_expr()));
         }
         debugPrint("</expr>");
         return node;
@@ -142,35 +188,47 @@ class Parser {
         while (current_token.type == Token::AND || current_token.type == Token::OR) {
             Token operator_token = current_token;
             eat(operator_token.type);
-            node = new BinaryOpNode(node, operator_token, expr());
+            node = at(operator_token, arena.make<BinaryOpNode>(node, operator_token, expr()));
         }
         debugPrint("</logic_expr>");
         return node;
     }
 
-    BlockNode* block() {
-        debugPrint("<block>");
-        BlockNode* node = new BlockNode();
+    /* Reads the indent a block starts with, and returns it */
+    int block_start() {
         if (current_token.type == Token::INDENT) {
             parse_indent();
             eat(Token::INDENT);
         }
-        int block_indent = indent_level.top();
-        node->children.push_back(statement());
+        return indent_level.top();
+    }
+
+    /* Moves to the next statement of a block indented by block_indent, or returns false when the block ends */
+    bool block_continues(int block_indent) {
+        if (current_token.type == Token::END_LINE || current_token.type == Token::EOF_TOKEN) return false;
+        if (current_token.type == Token::INDENT) {
+            parse_indent();
+            if (indent_level.top() == block_indent)
+                eat(Token::INDENT);
+        }
+        return indent_level.top() == block_indent;
+    }
+
+    /* A statement of a block, with the END_LINE after it */
+    AST* block_statement() {
+        AST* node = statement();
         if (current_token.type == Token::END_LINE)
             eat(Token::END_LINE);
-        while (current_token.type != Token::END_LINE && current_token.type != Token::EOF_TOKEN) {
-            if (current_token.type == Token::INDENT) {
-                parse_indent();
-                if (indent_level.top() == block_indent)
-                    eat(Token::INDENT);
-            }
-            if (indent_level.top() == block_indent) {
-                //eat(Token::INDENT);
-                node->children.push_back(statement());
-                if (current_token.type == Token::END_LINE)
-                    eat(Token::END_LINE);
-            } else break;
+        return node;
+    }
+
+    BlockNode* block() {
+        debugPrint("<block>");
+        BlockNode* node = arena.make<BlockNode>();
+        int block_indent = block_start();
+        node->children.push_back(block_statement());
+        while (block_continues(block_indent)) {
+            node->children.push_back(block_statement());
         }
         debugPrint("</block>");
         return node;
@@ -178,30 +236,70 @@ class Parser {
 
     AST* function_definition() {
         debugPrint("<def>");
+        Token keyword = current_token;
         eat(Token::DEF);
-        FunctionNode* function = new FunctionNode(current_token.value);
+        FunctionNode* function = at(keyword, arena.make<FunctionNode>(current_token.symbol));
         eat(Token::FUNCTION_ID);
         eat(Token::L_PAREN);
         if (current_token.type != Token::R_PAREN) {
-            function->parameters.push_back(current_token.value);
+            function->parameters.push_back(current_token.symbol);
             eat(Token::VARIABLE_ID);
         }
         while(current_token.type == Token::COMMA) {
             eat(Token::COMMA);
-            function->parameters.push_back(current_token.value);
+            function->parameters.push_back(current_token.symbol);
             eat(Token::VARIABLE_ID);
         }
         eat(Token::R_PAREN);
         eat(Token::COLON);
         eat(Token::END_LINE);
-        function->function_body = block();
+        if (LAZY && current_token.type == Token::INDENT && current_token.length > indent_level.top()) skim_body(function);
+        else function->function_body = block();
         debugPrint("</def>");
         return function;
     }
 
+    /* Steps over a function body without building it: the body ends at the first line indented no deeper
+       than the def, or at the end of the file. The tokens in between are only scanned, so a syntax error
+       in them is found when the body is parsed */
+    void skim_body(FunctionNode* function) {
+        int def_indent = indent_level.top();
+        function->lazy_begin = current_token.start;
+        function->lazy_line = current_token.line;
+        function->lazy_indent = def_indent;
+        while (current_token.type != Token::EOF_TOKEN
+               && (current_token.type != Token::INDENT || current_token.length > def_indent)) {
+            current_token = read_token();
+        }
+        function->lazy_end = current_token.type == Token::EOF_TOKEN ? scanner.text + scanner.length : current_token.start;
+        skimmed++;
+    }
+
+    /* Parses a body skim_body() stepped over, with a Parser of its own over just its lines, and keeps
+       the nodes in this Parser's arena. The caller attaches the body to the function */
+    BlockNode* parse_body(FunctionNode* function) {
+        Scanner body_scanner(function->lazy_begin, function->lazy_end - function->lazy_begin);
+        body_scanner.line = function->lazy_line;
+        Parser body_parser(body_scanner);
+        body_parser.LAZY = LAZY;
+        BlockNode* body = body_parser.lazy_body(function->lazy_indent);
+        skimmed += body_parser.skimmed;
+        body_parser.arena.move_into(arena);
+        return body;
+    }
+
+    /* The whole input as the body of a def indented by def_indent */
+    BlockNode* lazy_body(int def_indent) {
+        if (def_indent > 0) indent(def_indent);
+        current_token = read_token();
+        BlockNode* body = block();
+        if (current_token.type != Token::EOF_TOKEN) error();
+        return body;
+    }
+
     AST* function_call() {
         debugPrint("<function>");
-        FunctionCallNode* node = new FunctionCallNode(current_token.value);
+        FunctionCallNode* node = at(current_token, arena.make<FunctionCallNode>(current_token.symbol));
         eat(Token::FUNCTION_ID);
         eat(Token::L_PAREN);
         if (current_token.type != Token::R_PAREN)
@@ -215,13 +313,22 @@ class Parser {
         return node;
     }
 
-    AST* else_statement(int if_indent) {
+    /* Continues an if statement: each elif becomes another branch of the same node, so a ladder of
+       them is one flat list of conditions rather than a chain of nested else blocks */
+    AST* else_statement(ConditionalNode* node, int if_indent) {
+        if (if_indent == indent_level.top()) eat(Token::INDENT);
+        while (current_token.type == Token::ELIF) {
+            debugPrint("<elif>");
+            eat(Token::ELIF);
+            AST* condition = logic_expr();
+            eat(Token::COLON);
+            eat(Token::END_LINE);
+            node->add_branch(condition, block());
+            debugPrint("</elif>");
+            if (if_indent == indent_level.top()) eat(Token::INDENT);
+        }
         debugPrint("<else>");
-        int else_indent = indent_level.top();
         AST* else_body;
-        if (if_indent == else_indent) {
-            eat(Token::INDENT);
-        }
         if (current_token.type == Token::ELSE) {
             eat(Token::ELSE);
             eat(Token::COLON);
@@ -235,22 +342,64 @@ class Parser {
     AST* if_statement() {
         debugPrint("<if>");
         int if_indent = indent_level.top();
+        Token keyword = current_token;
         eat(Token::IF);
         AST* condition = logic_expr();
         eat(Token::COLON);
         eat(Token::END_LINE);
-        AST* if_body = block();
+        ConditionalNode* node = at(keyword, arena.make<ConditionalNode>());
+        node->add_branch(condition, block());
         debugPrint("</if>");
-        AST* else_body = else_statement(if_indent);
-        return new ConditionalNode(condition, if_body, else_body);
+        node->else_body = else_statement(node, if_indent);
+        return node;
+    }
+
+    AST* while_statement() {
+        debugPrint("<while>");
+        Token keyword = current_token;
+        eat(Token::WHILE);
+        AST* condition = logic_expr();
+        eat(Token::COLON);
+        eat(Token::END_LINE);
+        AST* body = block();
+        debugPrint("</while>");
+        return at(keyword, arena.make<WhileNode>(condition, body));
+    }
+
+    /* for NAME in range(stop), range(start, stop) or range(start, stop, step): range is the only thing
+       that can be iterated */
+    AST* for_statement() {
+        debugPrint("<for>");
+        Token keyword = current_token;
+        eat(Token::FOR);
+        VariableNode* loop_variable = variable();
+        eat(Token::IN);
+        if (current_token.type != Token::FUNCTION_ID || current_token.value() != "range") error();
+        Token range = current_token;
+        eat(Token::FUNCTION_ID);
+        eat(Token::L_PAREN);
+        vector<AST*> bounds(1, logic_expr());
+        while (current_token.type == Token::COMMA && bounds.size() < 3) {
+            eat(Token::COMMA);
+            bounds.push_back(logic_expr());
+        }
+        eat(Token::R_PAREN);
+        eat(Token::COLON);
+        eat(Token::END_LINE);
+        if (bounds.size() == 1) bounds.insert(bounds.begin(), at(range, arena.make<IntNode>(0)));
+        if (bounds.size() == 2) bounds.push_back(at(range, arena.make<IntNode>(1)));
+        AST* body = block();
+        debugPrint("</for>");
+        return at(keyword, arena.make<ForRangeNode>(loop_variable, bounds[0], bounds[1], bounds[2], body));
     }
 
     AST* return_statement() {
         debugPrint("<return>");
+        Token keyword = current_token;
         eat(Token::RETURN);
         AST* value = (current_token.type == Token::END_LINE ? empty() : logic_expr());
         eat(Token::END_LINE);
-        return new ReturnNode(value);
+        return at(keyword, arena.make<ReturnNode>(value));
         debugPrint("</return>");
     }
 
@@ -261,13 +410,18 @@ class Parser {
         eat(Token::ASSIGN);
         AST* right = logic_expr();
         debugPrint("</assign>");
-        return new AssignNode(left, token, right);
+        AssignNode* node = arena.make<AssignNode>(left, token, right);
+        node->line = left->line;
+        node->column = left->column;
+        return node;
     }
     
     AST* statement() {
         debugPrint("<statement>");
         AST* node;
         if (current_token.type == Token::IF)               node = if_statement();
+        else if (current_token.type == Token::WHILE)       node = while_statement();
+        else if (current_token.type == Token::FOR)         node = for_statement();
         else if (current_token.type == Token::DEF)         node = function_definition();
         else if (current_token.type == Token::RETURN)      node = return_statement();
         else if (current_token.type == Token::VARIABLE_ID) node = assignment_statement();
@@ -281,7 +435,7 @@ class Parser {
 
     VariableNode* variable() {
         debugPrint("<var>");
-        VariableNode* node = new VariableNode(current_token.value);
+        VariableNode* node = at(current_token, arena.make<VariableNode>(current_token.symbol));
         eat(Token::VARIABLE_ID);
         debugPrint("</var>");
         return node;
@@ -289,21 +443,52 @@ class Parser {
 
     AST* empty() {
         debugPrint("<empty>");
-        AST* node = new NoOp();
+        AST* node = arena.make<NoOp>();
         debugPrint("</empty>");
         return node;
     }
 
     AST* program() {
         debugPrint("<program>");
+        if (LEX_JOBS > 0 && TokenBuffer::fits(scanner.length)) {
+            tokens.scan(scanner.text, scanner.length, LEX_JOBS);
+            buffered = true;
+            next_token = 0;
+        }
+        current_token = read_token();
         AST* node = block();
         if (current_token.type != Token::EOF_TOKEN) {
             error();
         }
         debugPrint("</program>");
+        if (DEBUG_MODE) {
+            cout << endl << "AST arena: " << arena.node_count() << " nodes, " << arena.used() << " bytes used of "
+                 << arena.reserved() << " reserved in " << arena.block_count() << " blocks" << endl;
+        }
         return node;
     }
 
+    /* Streaming: reads the first token, after which next_statement() parses the program one top-level
+       statement at a time instead of program() parsing all of it */
+    void begin_statements() {
+        current_token = scanner.get_next_token();
+        stream_indent = block_start();
+        stream_started = false;
+    }
+
+    /* The next top-level statement, or nullptr at the end of the file */
+    AST* next_statement() {
+        if (stream_started && !block_continues(stream_indent)) {
+            if (current_token.type != Token::EOF_TOKEN) error();
+            return nullptr;
+        }
+        stream_started = true;
+        return block_statement();
+    }
+
+    /* How far the scanner has read into the source */
+    size_t position() const { return scanner.pos; }
+
     void debugPrint(string text) {
         if (!DEBUG_MODE) return;
         if (text[1] == '/') debug_depth--;
@@ -0,0 +1,193 @@
+#ifndef PROFILER_CPP
+#define PROFILER_CPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.cpp"
+#include "symbol.cpp"
+
+using namespace std;
+
+/* Records what --profile reports: calls, inclusive and exclusive time per function, hits per line, and
+   time per distinct call stack. Both backends call enter() when a function body starts running, leave()
+   when it returns, and line() at the start of every statement. A tail call ends the replaced frame and
+   starts the new one at the same instant, from the same parent */
+class Profiler {
+  private:
+    struct FunctionStats {
+        FunctionNode* function;
+        long long calls = 0;
+        int64_t inclusive = 0;
+        int64_t exclusive = 0;
+        int active = 0;
+        FunctionStats(FunctionNode* function) : function(function) {}
+    };
+
+    /* A call stack is a path in a tree of nodes, each one a function called from its parent's stack.
+       A node keeps its children and its function's stats at hand, so a call costs no map lookup
+       once its stack has been seen */
+    struct StackNode {
+        int parent;
+        FunctionStats* stats;
+        int64_t exclusive = 0;
+        vector<int> children;
+        StackNode(int parent, FunctionStats* stats) : parent(parent), stats(stats) {}
+    };
+
+    struct Frame {
+        FunctionStats* stats;
+        int stack;
+        int64_t start;
+        int64_t children = 0;
+        Frame(FunctionStats* stats, int stack, int64_t start) : stats(stats), stack(stack), start(start) {}
+    };
+
+    const char* source;
+    size_t source_size;
+    map<FunctionNode*, FunctionStats> functions;
+    vector<StackNode> stacks;
+    vector<Frame> frames;
+    vector<long long> line_hits;
+    FunctionStats module;
+
+    static int64_t now() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    FunctionStats* stats_for(FunctionNode* function) {
+        auto found = functions.find(function);
+        if (found == functions.end()) found = functions.insert({function, FunctionStats(function)}).first;
+        return &found->second;
+    }
+
+    int child_stack(int parent, FunctionNode* function) {
+        for (int child : stacks[parent].children) {
+            if (stacks[child].stats->function == function) return child;
+        }
+        stacks.emplace_back(parent, stats_for(function));
+        stacks[parent].children.push_back(stacks.size() - 1);
+        return stacks.size() - 1;
+    }
+
+    void push(FunctionStats* stats, int stack, int64_t at) {
+        stats->calls++;
+        stats->active++;
+        frames.emplace_back(stats, stack, at);
+    }
+
+    static string frame_name(FunctionNode* function) {
+        if (function == nullptr) return "<module>";
+        return symbol_name(function->id) + ":" + to_string(function->line);
+    }
+
+    /* The text of a line of the script, trimmed, for the summary */
+    string line_text(int line) {
+        const char* start = source;
+        const char* end = source + source_size;
+        for (int current = 1; current < line && start < end; start++) {
+            if (*start == '\n') current++;
+        }
+        const char* stop = start;
+        while (stop < end && *stop != '\n') stop++;
+        while (start < stop && *start == ' ') start++;
+        return string(start, stop - start);
+    }
+
+  public:
+    Profiler(const char* source, size_t source_size) : source(source), source_size(source_size), module(nullptr) {}
+    Profiler(const Profiler&) = delete;
+
+    /* Opens the module frame, which is the root of every stack */
+    void start() {
+        stacks.emplace_back(-1, &module);
+        push(&module, 0, now());
+    }
+
+    void enter(FunctionNode* function) {
+        int stack = child_stack(frames.back().stack, function);
+        push(stacks[stack].stats, stack, now());
+    }
+
+    void tail_call(FunctionNode* function) {
+        int64_t at = now();
+        leave(at);
+        int stack = child_stack(frames.back().stack, function);
+        push(stacks[stack].stats, stack, at);
+    }
+
+    /* A call answered from a memo table runs no code, so it only counts as a call */
+    void memo_hit(FunctionNode* function) {
+        stats_for(function)->calls++;
+    }
+
+    void leave(int64_t at = now()) {
+        Frame frame = frames.back();
+        frames.pop_back();
+        int64_t elapsed = at - frame.start;
+        int64_t exclusive = elapsed - frame.children;
+        frame.stats->exclusive += exclusive;
+        stacks[frame.stack].exclusive += exclusive;
+        /* Time of a recursive function counts once, in its outermost activation */
+        if (--frame.stats->active == 0) frame.stats->inclusive += elapsed;
+        if (!frames.empty()) frames.back().children += elapsed;
+    }
+
+    void line(int number) {
+        if (number >= (int) line_hits.size()) line_hits.resize(number + 1, 0);
+        line_hits[number]++;
+    }
+
+    /* Closes every open frame, including the module's. Also used when the program stops with an error */
+    void finish() {
+        while (!frames.empty()) leave();
+    }
+
+    /* One line per distinct stack, "<module>;f:1;g:5 <nanoseconds>", for flamegraph.pl and similar tools */
+    void write_collapsed(ostream& out) {
+        vector<string> paths(stacks.size());
+        for (size_t i = 0; i < stacks.size(); i++) {
+            /* A node is always created after its parent, so the parent's path is already built */
+            paths[i] = stacks[i].parent < 0 ? frame_name(nullptr) : paths[stacks[i].parent] + ";" + frame_name(stacks[i].stats->function);
+            if (stacks[i].exclusive > 0) out << paths[i] << " " << stacks[i].exclusive << "\n";
+        }
+    }
+
+    /* Functions by exclusive time, then the most executed lines */
+    void write_summary(ostream& out, size_t max_lines = 20) {
+        vector<FunctionStats*> sorted;
+        sorted.push_back(&module);
+        for (auto& entry : functions) sorted.push_back(&entry.second);
+        sort(sorted.begin(), sorted.end(), [](FunctionStats* a, FunctionStats* b) { return a->exclusive > b->exclusive; });
+
+        out << "profile: " << (module.inclusive / 1e6) << " ms total" << endl;
+        out << setw(12) << "calls" << setw(14) << "inclusive ms" << setw(14) << "exclusive ms" << "  function" << endl;
+        out << fixed << setprecision(3);
+        for (FunctionStats* stats : sorted) {
+            out << setw(12) << stats->calls << setw(14) << stats->inclusive / 1e6 << setw(14) << stats->exclusive / 1e6
+                << "  " << frame_name(stats->function) << endl;
+        }
+        out.unsetf(ios::floatfield);
+
+        vector<pair<long long, int>> lines;
+        for (size_t i = 1; i < line_hits.size(); i++) {
+            if (line_hits[i] > 0) lines.push_back(make_pair(line_hits[i], (int) i));
+        }
+        sort(lines.begin(), lines.end(), [](const pair<long long, int>& a, const pair<long long, int>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        if (lines.size() > max_lines) lines.resize(max_lines);
+        out << setw(12) << "hits" << setw(8) << "line" << "  source" << endl;
+        for (const pair<long long, int>& entry : lines) {
+            out << setw(12) << entry.first << setw(8) << entry.second << "  " << line_text(entry.second) << endl;
+        }
+    }
+};
+
+#endif
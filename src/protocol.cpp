@@ -0,0 +1,89 @@
+#ifndef PROTOCOL_CPP
+#define PROTOCOL_CPP
+
+#include <cstdint>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* Messages between mypython.exe --serve and mypython_client.exe. Both sides send frames: a kind byte, the
+   payload length as 4 little-endian bytes, then the payload. The client sends its arguments, then the
+   script as a path or as source text, then RUN. The server answers with any number of OUTPUT and ERROR
+   frames as the script runs, and ends with EXIT, whose payload is the exit status as text */
+enum FrameKind : char {
+    FRAME_ARG = 'a',
+    FRAME_PATH = 'p',
+    FRAME_SOURCE = 's',
+    FRAME_RUN = 'r',
+    FRAME_OUTPUT = 'o',
+    FRAME_ERROR = 'e',
+    FRAME_EXIT = 'x'
+};
+
+/* Where the server listens when no socket is given */
+const char* const DEFAULT_SOCKET_PATH = "/tmp/mypython.sock";
+
+/* Frames larger than this are refused, so a bad client cannot make the server allocate without bound */
+const uint32_t MAX_FRAME_SIZE = 1u << 30;
+
+#ifndef _WIN32
+inline bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t got = read(fd, data, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+inline bool send_frame(int fd, char kind, const char* data, size_t length) {
+    char header[5] = {kind, (char) (length & 0xff), (char) ((length >> 8) & 0xff), (char) ((length >> 16) & 0xff),
+                      (char) ((length >> 24) & 0xff)};
+    return write_all(fd, header, sizeof(header)) && write_all(fd, data, length);
+}
+
+inline bool send_frame(int fd, char kind, const string& payload) {
+    return send_frame(fd, kind, payload.data(), payload.size());
+}
+
+inline bool receive_frame(int fd, char& kind, string& payload) {
+    unsigned char header[5];
+    if (!read_all(fd, reinterpret_cast<char*>(header), sizeof(header))) return false;
+    uint32_t length = header[1] | header[2] << 8 | header[3] << 16 | (uint32_t) header[4] << 24;
+    if (length > MAX_FRAME_SIZE) return false;
+    kind = header[0];
+    payload.resize(length);
+    return length == 0 || read_all(fd, &payload[0], length);
+}
+
+/* Fills in the address of a socket file, or returns false when the path is too long for one */
+inline bool socket_address(const string& path, sockaddr_un& address) {
+    address = sockaddr_un();
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    path.copy(address.sun_path, path.size());
+    return true;
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef RESOLVER_CPP
+#define RESOLVER_CPP
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.cpp"
+
+using namespace std;
+
+/* Runs after Parser::program() and gives every variable, parameter and function name a (depth, slot) pair.
+   A name assigned or defined anywhere in a function body is local to it, as in Python; any other name
+   refers to the nearest enclosing function that binds it, and falls back to the module frame. */
+class Resolver {
+  private:
+    struct ResolverScope {
+        vector<Symbol>* names;
+        unordered_map<Symbol, int> index;
+        ResolverScope* enclosing;
+        /* The function whose frame this is, nullptr for the module */
+        FunctionNode* function;
+        ResolverScope(vector<Symbol>* names, ResolverScope* enclosing, FunctionNode* function = nullptr)
+            : names(names), enclosing(enclosing), function(function) {}
+    };
+
+    ResolverScope module;
+
+    int declare(ResolverScope* scope, Symbol id) {
+        auto found = scope->index.find(id);
+        if (found != scope->index.end()) return found->second;
+        scope->names->push_back(id);
+        scope->index.insert({id, (int) scope->names->size() - 1});
+        return scope->names->size() - 1;
+    }
+
+    /* Finds the frame that binds id, counting the parent links needed to reach it from scope */
+    void lookup(ResolverScope* scope, Symbol id, int& depth, int& slot) {
+        depth = 0;
+        for (ResolverScope* current = scope; current != &module; current = current->enclosing, depth++) {
+            auto found = current->index.find(id);
+            if (found != current->index.end()) {
+                slot = found->second;
+                return;
+            }
+        }
+        depth = GLOBAL_DEPTH;
+        slot = declare(&module, id);
+    }
+
+    /* Declares the names a block binds, without descending into nested function bodies */
+    void declare_block(AST* node_, ResolverScope* scope) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) declare_block(child, scope);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (AST* body : node->bodies) declare_block(body, scope);
+            declare_block(node->else_body, scope);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            declare_block(node->body, scope);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            declare(scope, node->variable->id);
+            declare_block(node->body, scope);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            declare(scope, node->left->id);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            declare(scope, node->id);
+        }
+    }
+
+    void resolve(AST* node_, ResolverScope* scope) {
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) resolve(child, scope);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                resolve(node->conditions[i], scope);
+                resolve(node->bodies[i], scope);
+            }
+            resolve(node->else_body, scope);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            resolve(node->condition, scope);
+            resolve(node->body, scope);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            resolve(node->start, scope);
+            resolve(node->stop, scope);
+            resolve(node->step, scope);
+            resolve(node->variable, scope);
+            resolve(node->body, scope);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            resolve(node->right, scope);
+            resolve(node->left, scope);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            lookup(scope, node->id, node->depth, node->slot);
+            resolve_function(node, scope);
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            resolve(node->value, scope);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            for (AST* parameter : node->parameters) resolve(parameter, scope);
+            if (node->id != PRINT_SYMBOL) lookup(scope, node->id, node->depth, node->slot);
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            lookup(scope, node->id, node->depth, node->slot);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            resolve(node->left, scope);
+            resolve(node->right, scope);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            resolve(node->expr, scope);
+        }
+    }
+
+    /* A body the Parser only skimmed is resolved by resolve_lazy() once it is parsed; its parameters are
+       declared now, since calls check them before the body is needed */
+    void resolve_function(FunctionNode* node, ResolverScope* enclosing) {
+        node->enclosing = enclosing->function;
+        ResolverScope scope(&node->locals, enclosing, node);
+        for (Symbol parameter : node->parameters) {
+            if (declare(&scope, parameter) != (int) node->locals.size() - 1)
+                throw runtime_error("Duplicate parameter \"" + symbol_name(parameter) + "\"");
+        }
+        declare_block(node->function_body, &scope);
+        resolve(node->function_body, &scope);
+    }
+
+  public:
+    /* Slot names of the module frame, in slot order */
+    vector<Symbol> globals;
+
+    Resolver() : module(&globals, nullptr) {}
+    Resolver(const Resolver&) = delete;
+
+    /* Resolves a module-level tree. Can be called again with more top-level code, which sees the same globals */
+    void resolve_program(AST* tree) {
+        declare_block(tree, &module);
+        resolve(tree, &module);
+    }
+
+    /* Resolves a body Parser::parse_body() parsed for node, before it is attached. The frames of the functions
+       around it were resolved with their own bodies, so their scopes are rebuilt from their locals; names
+       are only looked up in them, never added */
+    void resolve_lazy(FunctionNode* node, BlockNode* body) {
+        vector<FunctionNode*> chain;
+        for (FunctionNode* function = node; function != nullptr; function = function->enclosing) chain.push_back(function);
+        vector<ResolverScope> scopes;
+        scopes.reserve(chain.size());
+        ResolverScope* enclosing = &module;
+        for (size_t i = chain.size(); i > 0; i--) {
+            FunctionNode* function = chain[i - 1];
+            scopes.push_back(ResolverScope(&function->locals, enclosing, function));
+            for (size_t slot = 0; slot < function->locals.size(); slot++) {
+                scopes.back().index.insert({function->locals[slot], (int) slot});
+            }
+            enclosing = &scopes.back();
+        }
+        declare_block(body, enclosing);
+        resolve(body, enclosing);
+    }
+};
+
+#endif
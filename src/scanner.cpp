@@ -11,19 +11,30 @@ using namespace std;
 class Scanner {
 
   public:
-    string text;
-    int pos;
+    const char* text;
+    size_t length;
+    size_t pos;
     bool next_token_is_indent = true;
     char current_char;
-    Scanner(string input) : text(input), pos(0), current_char(text[pos]) {}
+    int line = 1;
+    size_t line_start = 0;
+    size_t previous_line_start = 0;
+    /* Set while inside a """ comment; still set at the end of the text when the comment runs past it */
+    bool in_comment = false;
+    Scanner(const char* input, size_t length) : text(input), length(length), pos(0), current_char(length > 0 ? text[0] : '\0') {}
 
     void error() {
         throw runtime_error("Invalid character");
     }
 
     void advance() {
+        if (current_char == '\n') {
+            line++;
+            previous_line_start = line_start;
+            line_start = pos + 1;
+        }
         pos = pos + 1;
-        if (pos >= text.length()) {
+        if (pos >= length) {
             current_char = '\0';
         } else {
             current_char = text[pos];
@@ -31,7 +42,7 @@ class Scanner {
     }
 
     char peek(int n = 1) {
-        if (pos + n >= text.length()) {
+        if (pos + n >= length) {
             return '\0';
         } else {
             return text[pos + n];
@@ -39,14 +50,34 @@ class Scanner {
     }
 
     char peek_behind(int n = 1) {
-        if (pos - n < 0) {
+        if (pos < (size_t) n) {
             return '\0';
         } else {
             return text[pos - n];
         }
     }
 
+    /* Gives a token the 1-based line and column of its first character. Only an END_LINE token
+       starts before the current line, on the one just finished */
+    Token locate(Token token, size_t start) {
+        if (start >= line_start) {
+            token.line = line;
+            token.column = start - line_start + 1;
+        } else {
+            token.line = line - 1;
+            token.column = start - previous_line_start + 1;
+        }
+        return token;
+    }
+
+    /* Token for the lexeme that runs from start to the current position */
+    Token make_token(Token::TokenType type, size_t start) {
+        return locate(Token(type, text + start, pos - start), start);
+    }
+
+    /* The length of an INDENT token is the indent width */
     Token skip_indent() {
+        size_t start = pos;
         int indent = 0;
         while (current_char == ' ') {
             advance();
@@ -56,7 +87,9 @@ class Scanner {
             next_token_is_indent = true;
             advance();
             return get_next_token();
-        } else return Token(Token::INDENT, to_string(indent));
+        } else if (current_char == '\0') {
+            return Token();
+        } else return make_token(Token::INDENT, start);
     }
 
     void skip_whitespace() {
@@ -75,48 +108,62 @@ class Scanner {
         advance();
         advance();
         advance();
+        finish_comment();
+    }
+
+    /* Skips to just past the """ that closes the current comment, or to the end of the text */
+    void finish_comment() {
+        in_comment = true;
         while (current_char != '\0') {
             if (current_char == '\"' && peek() == '\"' && peek(2) == '\"') {
                 advance();
                 advance();
                 advance();
-                break;
+                in_comment = false;
+                return;
             }
             advance();
         }
     }
 
+    /* Starts scanning inside a """ comment opened before the text, as when a file is scanned in pieces
+       and the previous piece ended in one. Tokens resume after the comment, mid-line */
+    void resume_comment() {
+        next_token_is_indent = false;
+        finish_comment();
+    }
+
     Token integer() {
-        string result = "";
+        size_t start = pos;
         while (current_char != '\0' && isdigit(current_char)) {
-            result += current_char;
             advance();
         }
-        return Token(Token::INT, result);
+        return make_token(Token::INT, start);
     }
 
     Token id() {
-        string result = "";
+        size_t start = pos;
         while (isalnum(current_char) || current_char == '_') {
-            result += current_char;
             advance();
         }
-        if (keywords.find(result) != keywords.end())
-            return Token(keywords.at(result), result);
-        if (current_char == '(')
-            return Token(Token::FUNCTION_ID, result);
-        else return Token(Token::VARIABLE_ID, result);
+        const Keyword* keyword = find_keyword(text + start, pos - start);
+        if (keyword != nullptr && keyword->type != Token::FUNCTION_ID)
+            return make_token(keyword->type, start);
+        Symbol symbol = symbols().intern(text + start, pos - start);
+        if (keyword != nullptr || current_char == '(')
+            return locate(Token(Token::FUNCTION_ID, text + start, pos - start, symbol), start);
+        else return locate(Token(Token::VARIABLE_ID, text + start, pos - start, symbol), start);
     }
 
     Token str() {
-        string result = "";
         advance();
+        size_t start = pos;
         while (current_char != '\0' && current_char != '\n' && current_char != '"') {
-            result += current_char;
             advance();
         }
+        Token token = make_token(Token::STRING, start);
         advance();
-        return Token(Token::STRING, result);
+        return token;
     }
 
     Token get_next_token() {
@@ -127,7 +174,7 @@ class Scanner {
             } else if (current_char == '\n') {
                 next_token_is_indent = true;
                 advance();
-                return Token(Token::END_LINE, "\n");
+                return make_token(Token::END_LINE, pos - 1);
             } else if (current_char == ' ') {
                 skip_whitespace();
                 continue;
@@ -146,71 +193,76 @@ class Scanner {
             } else if (current_char == '=' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::EQUALS, "==");
+                return make_token(Token::EQUALS, pos - 2);
             } else if (current_char == '!' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::NOT_EQUALS, "!=");
+                return make_token(Token::NOT_EQUALS, pos - 2);
             } else if (current_char == '<' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::LESS_THAN_EQUALS, "<=");
+                return make_token(Token::LESS_THAN_EQUALS, pos - 2);
             } else if (current_char == '>' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::GREATER_THAN_EQUALS, ">=");
+                return make_token(Token::GREATER_THAN_EQUALS, pos - 2);
             } else if (current_char == '+' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::PLUS_EQUALS, "+=");
+                return make_token(Token::PLUS_EQUALS, pos - 2);
             } else if (current_char == '-' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::MINUS_EQUALS, "-=");
+                return make_token(Token::MINUS_EQUALS, pos - 2);
             } else if (current_char == '*' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::TIMES_EQUALS, "*=");
+                return make_token(Token::TIMES_EQUALS, pos - 2);
             } else if (current_char == '/' && peek() == '=') {
                 advance();
                 advance();
-                return Token(Token::DIVIDE_EQUALS, "/=");
+                return make_token(Token::DIVIDE_EQUALS, pos - 2);
             } else if (current_char == '=') {
                 advance();
-                return Token(Token::ASSIGN, "=");
+                return make_token(Token::ASSIGN, pos - 1);
             } else if (current_char == '<') {
                 advance();
-                return Token(Token::LESS_THAN, "<");
+                return make_token(Token::LESS_THAN, pos - 1);
             } else if (current_char == '>') {
                 advance();
-                return Token(Token::GREATER_THAN, ">");
+                return make_token(Token::GREATER_THAN, pos - 1);
             } else if (current_char == '+') {
                 advance();
-                return Token(Token::PLUS, "+");
+                return make_token(Token::PLUS, pos - 1);
             } else if (current_char == '-') {
                 advance();
-                return Token(Token::MINUS, "-");
+                return make_token(Token::MINUS, pos - 1);
             } else if (current_char == '*') {
                 advance();
-                return Token(Token::TIMES, "*");
+                return make_token(Token::TIMES, pos - 1);
             } else if (current_char == '/') {
                 advance();
-                return Token(Token::DIVIDE, "/");
+                return make_token(Token::DIVIDE, pos - 1);
             } else if (current_char == '(') {
                 advance();
-                return Token(Token::L_PAREN, "(");
+                return make_token(Token::L_PAREN, pos - 1);
             } else if (current_char == ')') {
                 advance();
-                return Token(Token::R_PAREN, ")");
+                return make_token(Token::R_PAREN, pos - 1);
             } else if (current_char == ':') {
                 advance();
-                return Token(Token::COLON, ":");
+                return make_token(Token::COLON, pos - 1);
             } else if (current_char == ',') {
                 advance();
-                return Token(Token::COMMA, ",");
+                return make_token(Token::COMMA, pos - 1);
             }
             error();
         }
+        if (!next_token_is_indent) {
+            /* The last line has no trailing newline */
+            next_token_is_indent = true;
+            return Token(Token::END_LINE, "\n", 1);
+        }
         return Token();
     }
 };
@@ -4,31 +4,93 @@
 using namespace std;
 
 #include <iostream>
-#include <unordered_map>
-#include "ast.cpp"
+#include <string>
+#include <vector>
+#include "bigint.cpp"
+#include "symbol.cpp"
+#include "value.cpp"
 
+/* Flat frame of variable slots. The Resolver decides which slot each name lives in, and parent is the
+   frame the function was defined in, so a variable read is a walk of `depth` parents and an index */
 class Scope {
-  private:
-    unordered_map<string, AST*> scope;
-    Scope* parent;
   public:
-    Scope(Scope* node = nullptr) : parent(node) {}
-    void set(string id, AST* value) {
-        if (scope.find(id) == scope.end())
-            scope.insert({id, value});
-        else scope[id] = value;
+    int refs = 1;
+    Scope* parent;
+    vector<Value> slots;
+    const vector<Symbol>* names;
+
+    Scope(Scope* parent, int size, const vector<Symbol>* names) : parent(parent), slots(size, Value::unbound()), names(names) {
+        if (parent != nullptr) parent->refs++;
+    }
+    ~Scope() {
+        if (parent != nullptr) release(parent);
+    }
+
+    Value& get(int depth, int slot) {
+        Scope* scope = this;
+        while (depth-- > 0) scope = scope->parent;
+        return scope->slots[slot];
+    }
+    const string& name(int slot) {
+        return symbol_name(names->at(slot));
+    }
+    /* Grows the frame when the Resolver has declared more names since it was created */
+    void resize(int size) {
+        if (size > (int) slots.size()) slots.resize(size, Value::unbound());
+    }
+
+    static void release(Scope* scope) {
+        if (--scope->refs == 0) delete scope;
     }
-    AST* get(string id) {
-        if (scope.find(id) != scope.end()) 
-            return scope[id];
-        return parent != nullptr ? parent->get(id) : nullptr;
+    /* Called when a function returns. Drops the functions defined in this frame first, since they hold the frame alive */
+    static void exit(Scope* scope);
+};
+
+/* A function definition together with the frame it was defined in */
+struct Closure {
+    int refs;
+    FunctionNode* function;
+    Scope* env;
+    Closure(FunctionNode* function, Scope* env) : refs(1), function(function), env(env) {
+        env->refs++;
     }
-    AST* get_local(string id) {
-        return scope.find(id) != scope.end() ? scope[id] : nullptr;
+    ~Closure() {
+        Scope::release(env);
     }
-    Scope* get_parent() {
-        return parent;
+};
+
+inline void Scope::exit(Scope* scope) {
+    if (scope->refs > 1) {
+        for (Value& value : scope->slots) {
+            if (value.type == Value::FUNCTION && value.closure->env == scope) value = Value();
+        }
     }
+    release(scope);
+}
+
+/* Runs Scope::exit on a function's frame however the function leaves, so an error passing through a call
+   frees its frame too. A tail call that replaces the frame exits the old one and stores the new one here */
+struct FrameExit {
+    Scope* frame;
+    FrameExit(Scope* frame) : frame(frame) {}
+    FrameExit(const FrameExit&) = delete;
+    ~FrameExit() { Scope::exit(frame); }
 };
 
-#endif
\ No newline at end of file
+inline void Value::retain() const {
+    if (type == STRING) str->refs++;
+    else if (type == FUNCTION) closure->refs++;
+    else if (type == BIGINT) big->refs++;
+}
+
+inline void Value::release() {
+    if (type == STRING) {
+        StringObject::release(str);
+    } else if (type == FUNCTION) {
+        if (--closure->refs == 0) delete closure;
+    } else if (type == BIGINT) {
+        if (--big->refs == 0) delete big;
+    }
+}
+
+#endif
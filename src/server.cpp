@@ -0,0 +1,311 @@
+#ifndef SERVER_CPP
+#define SERVER_CPP
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cache.cpp"
+#include "interpreter.cpp"
+#include "output.cpp"
+#include "parser.cpp"
+#include "protocol.cpp"
+#include "scanner.cpp"
+#include "stack.cpp"
+
+using namespace std;
+
+#ifndef _WIN32
+#include <pthread.h>
+
+/* A script the server has prepared, kept for later requests with the same source and the same flags.
+   Its tree is parsed, resolved and optimized once; every request runs it in a fresh module frame */
+struct WarmProgram {
+    string text;
+    Scanner scanner;
+    Parser parser;
+    Interpreter interpreter;
+    AST* tree = nullptr;
+    /* Why the source could not be prepared, if it could not; the same source fails the same way */
+    string error;
+    /* Held while the program is prepared or run, since its tree and Interpreter serve one request at a time */
+    mutex lock;
+    /* Guarded by the server's lock */
+    int users = 0;
+    unsigned long last_used = 0;
+
+    WarmProgram(string source) : text(move(source)), scanner(text.data(), text.size()), parser(scanner), interpreter(parser) {}
+    WarmProgram(const WarmProgram&) = delete;
+};
+
+/* What a client asked for: the options it passed, as mypython.exe would take them, and the script */
+struct ServerRequest {
+    bool tree_mode = false;
+    bool optimize = true;
+    bool stats_mode = false;
+    bool memoize = false;
+    bool quicken = true;
+    bool lazy = false;
+    size_t recursion_limit = DEFAULT_RECURSION_LIMIT;
+    size_t lex_jobs = 0;
+    string path;
+    string source;
+    bool has_source = false;
+    string error;
+
+    void add_argument(const vector<string>& args, size_t& i) {
+        const string& arg = args[i];
+        if (arg == "--tree") tree_mode = true;
+        else if (arg == "--no-optimize") optimize = false;
+        else if (arg == "--stats") stats_mode = true;
+        else if (arg == "--memoize") memoize = true;
+        else if (arg == "--no-quicken") quicken = false;
+        else if (arg == "--lazy") lazy = true;
+        else if (arg == "--recursion-limit" && i + 1 < args.size()) recursion_limit = strtoul(args[++i].c_str(), nullptr, 10);
+        else if (arg == "--lex-jobs" && i + 1 < args.size()) lex_jobs = strtoul(args[++i].c_str(), nullptr, 10);
+        else if (error.empty()) error = "Error: " + arg + " is not supported by the server";
+    }
+};
+
+/* Runs scripts for mypython_client.exe over a Unix domain socket, so a stream of short scripts pays process
+   startup once instead of once each. Worker threads take connections as they come, one request per
+   connection. Prepared programs are kept by a hash of their source and the flags that shape their tree,
+   up to MAX_PROGRAMS of them, dropping the least recently used. Output goes back to the client as the
+   script produces it, and errors and --stats reports follow it.
+
+   Identifiers from every script are interned in the one symbol table, so once it holds more than
+   MAX_SYMBOLS names the server lets the requests running finish, holds new ones back, and starts over
+   with no prepared programs and an empty table */
+class ScriptServer {
+  private:
+    map<string, WarmProgram*> programs;
+    mutex programs_lock;
+    /* Guarded by programs_lock: requests between acquire() and release(), which may hold Symbols, and
+       whether the symbol table is waiting for them to finish so it can be cleared */
+    int running = 0;
+    bool trimming = false;
+    condition_variable idle;
+    unsigned long clock = 0;
+    int listener = -1;
+
+    static bool read_file(const string& path, string& text) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        text.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return true;
+    }
+
+    static void send_output(void* client, const char* text, size_t length) {
+        send_frame(*static_cast<int*>(client), FRAME_OUTPUT, text, length);
+    }
+
+    /* Reads frames up to RUN. Returns false when the client goes away first */
+    static bool read_request(int client, ServerRequest& request) {
+        vector<string> args;
+        char kind;
+        string payload;
+        while (receive_frame(client, kind, payload)) {
+            if (kind == FRAME_ARG) args.push_back(payload);
+            else if (kind == FRAME_PATH) request.path = payload;
+            else if (kind == FRAME_SOURCE) {
+                request.source.swap(payload);
+                request.has_source = true;
+            } else if (kind == FRAME_RUN) {
+                for (size_t i = 0; i < args.size(); i++) request.add_argument(args, i);
+                return true;
+            } else return false;
+        }
+        return false;
+    }
+
+    /* Drops the least recently used program that no request is using. Called with programs_lock held */
+    void evict() {
+        auto oldest = programs.end();
+        for (auto entry = programs.begin(); entry != programs.end(); ++entry) {
+            if (entry->second->users > 0) continue;
+            if (oldest == programs.end() || entry->second->last_used < oldest->second->last_used) oldest = entry;
+        }
+        if (oldest == programs.end()) return;
+        delete oldest->second;
+        programs.erase(oldest);
+    }
+
+    /* The program for key, made from text when it is not kept yet */
+    WarmProgram* acquire(const string& key, string& text, bool& warm) {
+        unique_lock<mutex> guard(programs_lock);
+        idle.wait(guard, [this] { return !trimming; });
+        running++;
+        auto found = programs.find(key);
+        warm = found != programs.end();
+        WarmProgram* program;
+        if (warm) program = found->second;
+        else {
+            if (programs.size() >= MAX_PROGRAMS) evict();
+            program = new WarmProgram(move(text));
+            programs.insert({key, program});
+        }
+        program->users++;
+        program->last_used = ++clock;
+        return program;
+    }
+
+    void release(WarmProgram* program) {
+        lock_guard<mutex> guard(programs_lock);
+        program->users--;
+        if (--running == 0) idle.notify_all();
+    }
+
+    /* Clears the symbol table once it holds more than MAX_SYMBOLS names, after the requests running now
+       finish, dropping every prepared program since their trees refer to its Symbols */
+    void trim_symbols() {
+        unique_lock<mutex> guard(programs_lock);
+        if (trimming || symbols().size() <= MAX_SYMBOLS) return;
+        trimming = true;
+        idle.wait(guard, [this] { return running == 0; });
+        size_t names = symbols().size();
+        for (auto& entry : programs) delete entry.second;
+        programs.clear();
+        symbols().clear();
+        trimming = false;
+        idle.notify_all();
+        cerr << "symbol table reached " << names << " names, cleared it with the prepared programs" << endl;
+    }
+
+    /* Runs one request, sending its output as it goes. Returns the exit status */
+    int run_request(int client, ServerRequest& request) {
+        if (!request.error.empty()) {
+            send_frame(client, FRAME_ERROR, request.error + "\n");
+            return 1;
+        }
+        string text;
+        if (request.has_source) text.swap(request.source);
+        else if (!read_file(request.path, text)) {
+            send_frame(client, FRAME_ERROR, "Error: Unable to open file " + request.path + "\n");
+            return 1;
+        }
+        string key = to_string(AstCache::hash(text.data(), text.size())) + ":" + to_string(text.size())
+                   + (request.optimize ? ":O" : ":-") + (request.memoize ? "M" : "-") + (request.quicken ? "Q" : "-")
+                   + (request.lazy && !request.memoize ? "L" : "-");
+        bool warm;
+        WarmProgram* program = acquire(key, text, warm);
+
+        ostringstream log;
+        int status = 0;
+        {
+            lock_guard<mutex> guard(program->lock);
+            OutputSink sink(send_output, &client);
+            Interpreter& interpreter = program->interpreter;
+            interpreter.out = &sink;
+            interpreter.diagnostics = &log;
+            try {
+                if (program->tree == nullptr && program->error.empty()) {
+                    interpreter.OPTIMIZE = request.optimize;
+                    interpreter.MEMOIZE = request.memoize;
+                    interpreter.QUICKEN = request.quicken;
+                    program->parser.LEX_JOBS = request.lex_jobs;
+                    program->parser.LAZY = request.lazy && !request.memoize;
+                    try {
+                        program->tree = interpreter.prepare();
+                    } catch (const exception& error) {
+                        program->error = error.what();
+                    }
+                }
+                if (!program->error.empty()) throw runtime_error(program->error);
+                interpreter.TREE_MODE = request.tree_mode;
+                interpreter.STATS_MODE = request.stats_mode;
+                interpreter.RECURSION_LIMIT = request.recursion_limit;
+                interpreter.run(program->tree);
+                sink.flush();
+                if (request.stats_mode || request.memoize) interpreter.print_stats();
+            } catch (const exception& error) {
+                sink.flush();
+                log << error.what() << endl;
+                status = 1;
+            }
+            if (request.stats_mode) log << "server: " << (warm ? "warm" : "cold") << " program" << endl;
+            interpreter.out = &output();
+            interpreter.diagnostics = &cerr;
+        }
+        release(program);
+        if (!log.str().empty()) send_frame(client, FRAME_ERROR, log.str());
+        return status;
+    }
+
+    void handle(int client) {
+        ServerRequest request;
+        if (!read_request(client, request)) return;
+        int status = run_request(client, request);
+        send_frame(client, FRAME_EXIT, to_string(status));
+        trim_symbols();
+    }
+
+    void work() {
+        for (;;) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
+            }
+            handle(client);
+            close(client);
+        }
+    }
+
+    static void* start_worker(void* server) {
+        static_cast<ScriptServer*>(server)->work();
+        return nullptr;
+    }
+
+  public:
+    size_t JOBS = max(1u, thread::hardware_concurrency());
+    size_t MAX_PROGRAMS = 1024;
+    size_t MAX_SYMBOLS = 1 << 20;
+
+    ScriptServer() {}
+    ScriptServer(const ScriptServer&) = delete;
+    ~ScriptServer() {
+        for (auto& entry : programs) delete entry.second;
+    }
+
+    /* Listens on path until the process is stopped. A socket file left at path by an earlier server is
+       replaced. Returns the process exit code if listening fails */
+    int serve(const string& path) {
+        sockaddr_un address;
+        if (!socket_address(path, address)) {
+            cerr << "Error: Socket path is too long: " << path << endl;
+            return 1;
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+            || listen(listener, SOMAXCONN) < 0) {
+            cerr << "Error: Unable to listen on " << path << endl;
+            return 1;
+        }
+        /* A client that goes away mid-script must not take the server down with it */
+        signal(SIGPIPE, SIG_IGN);
+        cerr << "serving on " << path << " with " << JOBS << " threads" << endl;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+        vector<pthread_t> workers(JOBS);
+        for (pthread_t& worker : workers) pthread_create(&worker, &attributes, &ScriptServer::start_worker, this);
+        pthread_attr_destroy(&attributes);
+        for (pthread_t& worker : workers) pthread_join(worker, nullptr);
+        close(listener);
+        return 1;
+    }
+};
+
+#endif
+
+#endif
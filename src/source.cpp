@@ -0,0 +1,100 @@
+#ifndef SOURCE_CPP
+#define SOURCE_CPP
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* Read-only view of a script. The file is memory-mapped where the platform allows it, so the Scanner
+   and the tokens it produces point straight into the page cache instead of into copies */
+class SourceFile {
+  private:
+    /* discard_before() waits until at least this much more of the file has been read */
+    static const size_t DISCARD_STEP = 1 << 20;
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    size_t discarded = 0;
+    string buffer;
+
+    bool read_into_buffer(const string& path) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+        return true;
+    }
+
+  public:
+    SourceFile() {}
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    ~SourceFile() {
+#ifndef _WIN32
+        if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    bool open(const string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                madvise(address, info.st_size, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(address);
+                length = info.st_size;
+                mapped = true;
+                close(fd);
+                return true;
+            }
+        }
+        close(fd);
+#endif
+        return read_into_buffer(path);
+    }
+
+    /* Uses text that is already in memory, e.g. for generated scripts */
+    void assign(string text) {
+#ifndef _WIN32
+        if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+        mapped = false;
+        discarded = 0;
+        buffer = move(text);
+        bytes = buffer.data();
+        length = buffer.size();
+    }
+
+    /* Lets the system drop the mapped pages before offset from memory. They are read from the file
+       again if anything looks at them later, so this only trims the resident size of a long script */
+    void discard_before(size_t offset) {
+#ifndef _WIN32
+        if (!mapped) return;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t end = offset / page * page;
+        if (end >= discarded + DISCARD_STEP) {
+            madvise(const_cast<char*>(bytes) + discarded, end - discarded, MADV_DONTNEED);
+            discarded = end;
+        }
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+#endif
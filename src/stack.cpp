@@ -0,0 +1,55 @@
+#ifndef STACK_CPP
+#define STACK_CPP
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+using namespace std;
+
+/* The native stack of the batch runner's and the server's worker threads. Parsing nests natively, and so do
+   the walker's calls when a worker runs them, so workers get room for the default recursion limit and more */
+const size_t WORKER_STACK_SIZE = (size_t) 64 << 20;
+
+/* Runs body on a new thread with a native stack of about stack_size bytes and waits for it, rethrowing
+   whatever it threw. body is given the size the stack actually got: when a thread that large cannot be
+   made, smaller ones are tried, and as a last resort body runs on the calling thread, given 0 */
+inline void run_on_stack(size_t stack_size, const function<void(size_t)>& body) {
+    struct Task {
+        const function<void(size_t)>* body;
+        size_t stack_size;
+        exception_ptr error;
+        static void* start(void* argument) {
+            Task* task = static_cast<Task*>(argument);
+            try {
+                (*task->body)(task->stack_size);
+            } catch (...) {
+                task->error = current_exception();
+            }
+            return nullptr;
+        }
+    } task;
+    task.body = &body;
+#ifndef _WIN32
+    for (size_t size = stack_size; size >= ((size_t) 1 << 20); size /= 2) {
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        bool sized = pthread_attr_setstacksize(&attributes, size) == 0;
+        pthread_t thread;
+        task.stack_size = size;
+        bool started = sized && pthread_create(&thread, &attributes, &Task::start, &task) == 0;
+        pthread_attr_destroy(&attributes);
+        if (!started) continue;
+        pthread_join(thread, nullptr);
+        if (task.error) rethrow_exception(task.error);
+        return;
+    }
+#endif
+    body(0);
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SYMBOL_CPP
+#define SYMBOL_CPP
+
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Identifiers are interned once by the Scanner; every later stage compares and hashes these ids */
+typedef int Symbol;
+
+/* Symbol of the builtin print, interned before anything else */
+const Symbol PRINT_SYMBOL = 0;
+
+/* Open-addressing table from identifier text to Symbol. Lookups hash the source bytes in place.
+   Scripts run on several threads share it, so every access takes the lock; names live in a deque
+   so the references name() hands out stay valid while other threads intern more */
+class SymbolTable {
+  private:
+    mutable mutex lock;
+    deque<string> names;
+    vector<unsigned> hashes;
+    vector<int> buckets;
+
+    static unsigned hash(const char* start, size_t length) {
+        unsigned h = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            h = (h ^ (unsigned char) start[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    void grow() {
+        vector<int> larger(buckets.size() * 2, -1);
+        size_t mask = larger.size() - 1;
+        for (size_t id = 0; id < names.size(); id++) {
+            size_t i = hashes[id] & mask;
+            while (larger[i] != -1) i = (i + 1) & mask;
+            larger[i] = id;
+        }
+        buckets.swap(larger);
+    }
+
+  public:
+    SymbolTable() : buckets(64, -1) {
+        intern("print", 5);
+    }
+
+    Symbol intern(const char* start, size_t length) {
+        unsigned h = hash(start, length);
+        lock_guard<mutex> guard(lock);
+        size_t mask = buckets.size() - 1;
+        size_t i = h & mask;
+        while (buckets[i] != -1) {
+            int id = buckets[i];
+            if (hashes[id] == h && names[id].size() == length && memcmp(names[id].data(), start, length) == 0)
+                return id;
+            i = (i + 1) & mask;
+        }
+        Symbol id = names.size();
+        names.push_back(string(start, length));
+        hashes.push_back(h);
+        buckets[i] = id;
+        if (names.size() * 2 > buckets.size()) grow();
+        return id;
+    }
+
+    Symbol intern(const string& name) {
+        return intern(name.data(), name.size());
+    }
+
+    const string& name(Symbol id) const {
+        lock_guard<mutex> guard(lock);
+        return names[id];
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return names.size();
+    }
+
+    /* Forgets every name but print, so the table does not grow for the life of a resident process. Only
+       for when nothing holds a Symbol or a name from it any more */
+    void clear() {
+        {
+            lock_guard<mutex> guard(lock);
+            names.clear();
+            hashes.clear();
+            buckets.assign(64, -1);
+        }
+        intern("print", 5);
+    }
+};
+
+/* The process-wide symbol table */
+inline SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+inline const string& symbol_name(Symbol id) {
+    return symbols().name(id);
+}
+
+#endif
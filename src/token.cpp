@@ -1,8 +1,9 @@
 #ifndef TOKEN_CPP
 #define TOKEN_CPP
 
+#include <cstring>
 #include <string>
-#include <unordered_map>
+#include "symbol.cpp"
 
 using namespace std;
 
@@ -25,28 +26,51 @@ struct Token {
         BOOL, INT, STRING, VARIABLE_ID, FUNCTION_ID, INDENT,
 
         // keywords
-        DEF, IF, ELIF, ELSE, RETURN, NOT, OR, AND
+        DEF, IF, ELIF, ELSE, RETURN, NOT, OR, AND, WHILE, FOR, IN
     };
     TokenType type;
-    string value;
+    const char* start;
+    int length;
+    Symbol symbol;
+    int line = 0;
+    int column = 0;
 
-    Token() : type(EOF_TOKEN), value("") {}
-    Token(TokenType t, string v) : type(t), value(v) {}
-    Token(const Token& token) : type(token.type), value(token.value) {}
+    Token() : type(EOF_TOKEN), start(""), length(0), symbol(-1) {}
+    Token(TokenType t, const char* s, int n, Symbol id = -1) : type(t), start(s), length(n), symbol(id) {}
+
+    /* Copies the lexeme out of the source buffer */
+    string value() const { return string(start, length); }
+};
+
+/* Keywords are matched against the source buffer directly, without building a string */
+struct Keyword {
+    const char* text;
+    int length;
+    Token::TokenType type;
 };
 
-const unordered_map<string, Token::TokenType> keywords = {
-    {"def",    Token::DEF},
-    {"if",     Token::IF},
-    {"elif",   Token::ELIF},
-    {"else",   Token::ELSE},
-    {"return", Token::RETURN},
-    {"not",    Token::NOT},
-    {"or",     Token::OR},
-    {"and",    Token::AND},
-    {"print",  Token::FUNCTION_ID},
-    {"True",   Token::BOOL},
-    {"False",  Token::BOOL},
+const Keyword keywords[] = {
+    {"def",    3, Token::DEF},
+    {"if",     2, Token::IF},
+    {"elif",   4, Token::ELIF},
+    {"else",   4, Token::ELSE},
+    {"return", 6, Token::RETURN},
+    {"not",    3, Token::NOT},
+    {"or",     2, Token::OR},
+    {"and",    3, Token::AND},
+    {"while",  5, Token::WHILE},
+    {"for",    3, Token::FOR},
+    {"in",     2, Token::IN},
+    {"print",  5, Token::FUNCTION_ID},
+    {"True",   4, Token::BOOL},
+    {"False",  5, Token::BOOL},
 };
 
+inline const Keyword* find_keyword(const char* start, int length) {
+    for (const Keyword& keyword : keywords) {
+        if (keyword.length == length && memcmp(keyword.text, start, length) == 0) return &keyword;
+    }
+    return nullptr;
+}
+
 #endif
\ No newline at end of file
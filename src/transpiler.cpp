@@ -0,0 +1,645 @@
+#ifndef TRANSPILER_CPP
+#define TRANSPILER_CPP
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.cpp"
+#include "operations.cpp"
+#include "symbol.cpp"
+#include "token.cpp"
+#include "value.cpp"
+
+using namespace std;
+
+/* Writes a program, as the tree from Parser::program() after resolving and optimizing, as one C++
+   translation unit over native/runtime.cpp. Every FunctionNode becomes a C++ function and the module
+   becomes run_module(). The program behaves as it does on the VM: the same operator semantics, the same
+   errors in the same order, tail calls in constant space and the recursion limit.
+
+   Variables are C++ locals. One that is only ever bound to machine integers, or only to booleans, and is
+   never read before it is assigned is an int64_t or a bool; the rest are Values. Arithmetic gives a
+   Value, since it can overflow into a BigInt, so integers are typed mostly through range() loops and
+   literals. A variable a nested function reads lives in its function's frame instead, a Scope its
+   closures hold on to, and a module variable any function reads is a static Value */
+class Transpiler {
+  private:
+    enum CType { UNTYPED, NATIVE_INT, NATIVE_BOOL, DYNAMIC };
+
+    struct Slot {
+        Symbol name = -1;
+        CType type = UNTYPED;
+        /* Read by a nested function; for a module slot, read by any function */
+        bool captured = false;
+        /* Parameters and function names hold whatever they are given */
+        bool pinned = false;
+        /* Every read at this function's own level comes after an assignment on every path */
+        bool definite = true;
+        /* Read at this function's own level. A slot neither read nor captured is never declared, and
+           assigning it only evaluates the value */
+        bool read = false;
+        /* The expressions assigned to the slot, and the ForRangeNodes counting in it */
+        vector<AST*> bindings;
+    };
+
+    /* A function being written, or the module when node is nullptr */
+    struct Function {
+        FunctionNode* node = nullptr;
+        string name;
+        string descriptor;
+        vector<Slot> slots;
+        /* Functions defined in it close over a frame */
+        bool has_frame = false;
+        /* Its code reads the frame it was defined in, or the arguments it was called with */
+        bool uses_env = false;
+        bool uses_arguments = false;
+    };
+
+    /* What an expression was written as: its C++ text and type, and whether evaluating it can neither
+       fail nor have an effect, so it does not matter when it is evaluated */
+    struct Code {
+        string text;
+        CType type;
+        bool pure;
+    };
+
+    /* Tracks which slots are assigned on every path to the statement being looked at */
+    struct Flow {
+        vector<char> assigned;
+        bool live = true;
+    };
+
+    vector<Symbol> globals;
+    vector<Function*> functions;
+    unordered_map<FunctionNode*, Function*> by_node;
+    /* Reads of the current function's own slots that always follow an assignment */
+    unordered_set<AST*> definite_reads;
+    vector<string> constants;
+    unordered_map<string, string> constant_names;
+    Function* current = nullptr;
+    int temporaries = 0;
+
+    Function* add_function(FunctionNode* node, const vector<Symbol>& names) {
+        Function* function = new Function();
+        function->node = node;
+        function->slots.resize(names.size());
+        for (size_t i = 0; i < names.size(); i++) function->slots[i].name = names[i];
+        if (node != nullptr) {
+            string base = symbol_name(node->id) + "_" + to_string(functions.size());
+            function->name = "fn_" + base;
+            function->descriptor = "fd_" + base;
+            for (size_t i = 0; i < node->parameters.size(); i++) function->slots[i].pinned = true;
+            by_node[node] = function;
+        }
+        functions.push_back(function);
+        return function;
+    }
+
+    /* The slot a name bound at the function's own level refers to */
+    Slot* own_slot(Function* function, int depth, int slot) {
+        bool own = function->node == nullptr ? depth == GLOBAL_DEPTH : depth == 0;
+        return own ? &function->slots[slot] : nullptr;
+    }
+
+    /* First pass: a Function for every FunctionNode, what each slot is bound to, and which slots nested
+       functions read. chain holds the functions around node, innermost last */
+    void scan(AST* node_, vector<Function*>& chain) {
+        if (node_ == nullptr) return;
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) scan(child, chain);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                scan(node->conditions[i], chain);
+                scan(node->bodies[i], chain);
+            }
+            scan(node->else_body, chain);
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            scan(node->condition, chain);
+            scan(node->body, chain);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            scan(node->start, chain);
+            scan(node->stop, chain);
+            scan(node->step, chain);
+            bind(chain, node->variable->depth, node->variable->slot, node);
+            scan(node->body, chain);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            scan(node->right, chain);
+            bind(chain, node->left->depth, node->left->slot, node->right);
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            if (node->function_body == nullptr) throw runtime_error("Function \"" + symbol_name(node->id) + "\" has no body");
+            Slot& slot = chain.back()->slots[node->slot];
+            slot.pinned = true;
+            slot.bindings.push_back(node);
+            chain.back()->has_frame = true;
+            chain.push_back(add_function(node, node->locals));
+            scan(node->function_body, chain);
+            chain.pop_back();
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            scan(node->value, chain);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            if (node->id != PRINT_SYMBOL) use(chain, node->depth, node->slot);
+            for (AST* parameter : node->parameters) scan(parameter, chain);
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            use(chain, node->depth, node->slot);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            scan(node->left, chain);
+            scan(node->right, chain);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            scan(node->expr, chain);
+        }
+    }
+
+    void bind(vector<Function*>& chain, int depth, int slot, AST* binding) {
+        Slot* target = own_slot(chain.back(), depth, slot);
+        if (target == nullptr) throw runtime_error("Cannot assign to an enclosing scope");
+        target->bindings.push_back(binding);
+    }
+
+    void use(vector<Function*>& chain, int depth, int slot) {
+        if (Slot* own = own_slot(chain.back(), depth, slot)) own->read = true;
+        if (depth == GLOBAL_DEPTH) {
+            if (chain.size() > 1) chain[0]->slots[slot].captured = true;
+        } else if (depth > 0) {
+            chain[chain.size() - 1 - depth]->slots[slot].captured = true;
+        }
+    }
+
+    /* Second pass: definite assignment. Records the reads that always follow an assignment, and marks the
+       slots read without one, which keep the check for an unassigned variable */
+    void flow_statement(AST* node_, Flow& flow, Function* function) {
+        if (node_ == nullptr) return;
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) flow_statement(child, flow, function);
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            Flow merged;
+            merged.assigned.assign(flow.assigned.size(), 1);
+            merged.live = false;
+            for (size_t i = 0; i <= node->conditions.size(); i++) {
+                if (i < node->conditions.size()) flow_expression(node->conditions[i], flow, function);
+                Flow branch = flow;
+                flow_statement(i < node->conditions.size() ? node->bodies[i] : node->else_body, branch, function);
+                if (!branch.live) continue;
+                if (!merged.live) merged = branch;
+                else for (size_t slot = 0; slot < merged.assigned.size(); slot++) merged.assigned[slot] &= branch.assigned[slot];
+            }
+            flow = merged;
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            flow_expression(node->condition, flow, function);
+            Flow body = flow;
+            flow_statement(node->body, body, function);
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            flow_expression(node->start, flow, function);
+            flow_expression(node->stop, flow, function);
+            flow_expression(node->step, flow, function);
+            Flow body = flow;
+            body.assigned[node->variable->slot] = 1;
+            flow_statement(node->body, body, function);
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            flow_expression(node->right, flow, function);
+            flow.assigned[node->left->slot] = 1;
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            flow.assigned[node->slot] = 1;
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            flow_expression(node->value, flow, function);
+            flow.assigned.assign(flow.assigned.size(), 1);
+            flow.live = false;
+        } else {
+            flow_expression(node_, flow, function);
+        }
+    }
+
+    void flow_expression(AST* node_, const Flow& flow, Function* function) {
+        if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            if (node->id != PRINT_SYMBOL) flow_read(node, node->depth, node->slot, flow, function);
+            for (AST* parameter : node->parameters) flow_expression(parameter, flow, function);
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            flow_read(node, node->depth, node->slot, flow, function);
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            flow_expression(node->left, flow, function);
+            flow_expression(node->right, flow, function);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            flow_expression(node->expr, flow, function);
+        }
+    }
+
+    void flow_read(AST* node, int depth, int slot, const Flow& flow, Function* function) {
+        Slot* read = own_slot(function, depth, slot);
+        if (read == nullptr) return;
+        if (flow.assigned[slot]) definite_reads.insert(node);
+        else read->definite = false;
+    }
+
+    static CType join(CType a, CType b) {
+        if (a == UNTYPED) return b;
+        if (b == UNTYPED || a == b) return a;
+        return DYNAMIC;
+    }
+
+    /* Third pass: the type of each expression, given the slot types found so far. It must agree with
+       the Code that expression() writes for the same node */
+    CType type_of(AST* node_, Function* function) {
+        if (IntNode* node = dynamic_cast<IntNode*>(node_)) {
+            return node->constant.type == Value::INT ? NATIVE_INT : DYNAMIC;
+        } else if (dynamic_cast<BoolNode*>(node_)) {
+            return NATIVE_BOOL;
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            Slot* slot = own_slot(function, node->depth, node->slot);
+            return slot != nullptr ? slot->type : DYNAMIC;
+        } else if (dynamic_cast<ForRangeNode*>(node_)) {
+            return NATIVE_INT;
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            return is_arithmetic(node->op.type) ? DYNAMIC : NATIVE_BOOL;
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            if (node->op.type == Token::NOT) return NATIVE_BOOL;
+            if (node->op.type != Token::PLUS) return DYNAMIC;
+            CType operand = type_of(node->expr, function);
+            return operand == UNTYPED || operand == NATIVE_INT ? operand : DYNAMIC;
+        }
+        return DYNAMIC;
+    }
+
+    static bool is_arithmetic(Token::TokenType op) {
+        return op == Token::PLUS || op == Token::MINUS || op == Token::TIMES || op == Token::DIVIDE;
+    }
+
+    /* Slots that can be native start untyped and are widened until every binding fits; the rest are
+       Values. A slot left untyped is only ever bound to itself and the like, and becomes a Value */
+    void infer_types() {
+        for (Function* function : functions) {
+            for (Slot& slot : function->slots) {
+                bool native = !slot.captured && !slot.pinned && slot.definite && !slot.bindings.empty();
+                slot.type = native ? UNTYPED : DYNAMIC;
+            }
+        }
+        for (bool untyped = true; untyped;) {
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (Function* function : functions) {
+                    for (Slot& slot : function->slots) {
+                        if (slot.type == DYNAMIC) continue;
+                        CType type = slot.type;
+                        for (AST* binding : slot.bindings) type = join(type, type_of(binding, function));
+                        if (type != slot.type) {
+                            slot.type = type;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+            untyped = false;
+            for (Function* function : functions) {
+                for (Slot& slot : function->slots) {
+                    if (slot.type != UNTYPED) continue;
+                    slot.type = DYNAMIC;
+                    untyped = true;
+                }
+            }
+        }
+    }
+
+    /* Fourth pass: writing C++ */
+
+    static string literal(const string& text) {
+        string result = "\"";
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\' || c == '?' || c < 0x20 || c >= 0x7f) {
+                char escape[5];
+                snprintf(escape, sizeof(escape), "\\%03o", c);
+                result += escape;
+            } else result += (char) c;
+        }
+        return result + "\"";
+    }
+
+    string constant(const Value& value) {
+        string declaration;
+        if (value.type == Value::STRING) {
+            const string& text = value.text();
+            declaration = "Value::make_string(string(" + literal(text) + ", " + to_string(text.size()) + "))";
+        } else {
+            string digits = value.big->to_decimal();
+            bool negative = digits[0] == '-';
+            declaration = "big_constant(\"" + digits.substr(negative ? 1 : 0) + "\", " + (negative ? "true" : "false") + ")";
+        }
+        auto found = constant_names.find(declaration);
+        if (found != constant_names.end()) return found->second;
+        string name = (value.type == Value::STRING ? "s_" : "b_") + to_string(constant_names.size());
+        constants.push_back("static const Value " + name + " = " + declaration + ";");
+        constant_names.insert({declaration, name});
+        return name;
+    }
+
+    static string boxed(const Code& code) {
+        if (code.type == NATIVE_INT) return "Value::make_int(" + code.text + ")";
+        if (code.type == NATIVE_BOOL) return "Value::make_bool(" + code.text + ")";
+        return code.text;
+    }
+
+    /* An operand of the runtime's operator overloads, which take machine integers as they are */
+    static string operand(const Code& code) {
+        return code.type == NATIVE_INT ? code.text : boxed(code);
+    }
+
+    static string token_name(Token::TokenType op) {
+        switch (op) {
+            case Token::PLUS:                return "Token::PLUS";
+            case Token::MINUS:               return "Token::MINUS";
+            case Token::TIMES:               return "Token::TIMES";
+            case Token::DIVIDE:              return "Token::DIVIDE";
+            case Token::EQUALS:              return "Token::EQUALS";
+            case Token::NOT_EQUALS:          return "Token::NOT_EQUALS";
+            case Token::LESS_THAN:           return "Token::LESS_THAN";
+            case Token::GREATER_THAN:        return "Token::GREATER_THAN";
+            case Token::LESS_THAN_EQUALS:    return "Token::LESS_THAN_EQUALS";
+            case Token::GREATER_THAN_EQUALS: return "Token::GREATER_THAN_EQUALS";
+            default:                         throw runtime_error("Invalid operation");
+        }
+    }
+
+    static string cpp_operator(Token::TokenType op) {
+        switch (op) {
+            case Token::EQUALS:              return " == ";
+            case Token::NOT_EQUALS:          return " != ";
+            case Token::LESS_THAN:           return " < ";
+            case Token::GREATER_THAN:        return " > ";
+            case Token::LESS_THAN_EQUALS:    return " <= ";
+            default:                         return " >= ";
+        }
+    }
+
+    /* Where a slot of the current function lives */
+    string storage(int depth, int slot) {
+        if (depth == GLOBAL_DEPTH && current->node != nullptr) return "g_" + symbol_name(functions[0]->slots[slot].name);
+        const Slot& own = current->slots[slot];
+        if (current->node == nullptr) return (own.captured ? "g_" : "v_") + symbol_name(own.name);
+        if (own.captured) return "frame->slots[" + to_string(slot) + "]";
+        return "v_" + symbol_name(own.name);
+    }
+
+    Code read(AST* node, Symbol id, int depth, int slot) {
+        Slot* own = own_slot(current, depth, slot);
+        if (own != nullptr && own->type != DYNAMIC) return {"v_" + symbol_name(id), own->type, true};
+        string place;
+        if (own != nullptr || depth == GLOBAL_DEPTH) place = storage(depth, slot);
+        else {
+            place = "env->get(" + to_string(depth - 1) + ", " + to_string(slot) + ")";
+            current->uses_env = true;
+        }
+        if (own != nullptr && definite_reads.count(node)) return {place, DYNAMIC, true};
+        return {"load(" + place + ", " + literal(symbol_name(id)) + ")", DYNAMIC, false};
+    }
+
+    /* Writes an assignment, or for a slot nothing reads, whatever evaluating the value does */
+    void store(ostringstream& out, int indent, int depth, int slot, const Code& value) {
+        const Slot& target = current->slots[slot];
+        if (!target.captured && !target.read) {
+            if (!value.pure) line(out, indent, "(void) " + value.text + ";");
+        } else if (target.type != DYNAMIC) {
+            line(out, indent, storage(depth, slot) + " = " + value.text + ";");
+        } else {
+            line(out, indent, storage(depth, slot) + " = " + boxed(value) + ";");
+        }
+    }
+
+    /* The callee and arguments of a call, or the arguments of a print, evaluated in order */
+    string arguments(FunctionCallNode* node) {
+        vector<string> items;
+        if (node->id != PRINT_SYMBOL) items.push_back(boxed(read(node, node->id, node->depth, node->slot)));
+        for (AST* parameter : node->parameters) items.push_back(boxed(expression(parameter)));
+        string text = "Values<" + to_string(items.size()) + ">{{";
+        for (size_t i = 0; i < items.size(); i++) text += (i > 0 ? ", " : "") + items[i];
+        return text + "}}";
+    }
+
+    Code expression(AST* node_) {
+        if (IntNode* node = dynamic_cast<IntNode*>(node_)) {
+            if (node->constant.type != Value::INT) return {constant(node->constant), DYNAMIC, true};
+            int64_t value = node->constant.integer;
+            return {value == INT64_MIN ? "INT64_MIN" : "INT64_C(" + to_string(value) + ")", NATIVE_INT, true};
+        } else if (BoolNode* node = dynamic_cast<BoolNode*>(node_)) {
+            return {node->value ? "true" : "false", NATIVE_BOOL, true};
+        } else if (StringNode* node = dynamic_cast<StringNode*>(node_)) {
+            return {constant(node->constant), DYNAMIC, true};
+        } else if (VariableNode* node = dynamic_cast<VariableNode*>(node_)) {
+            return read(node, node->id, node->depth, node->slot);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            if (node->id == PRINT_SYMBOL)
+                return {node->parameters.empty() ? "print_values()" : "print_values(" + arguments(node) + ")", DYNAMIC, false};
+            return {"call(" + arguments(node) + ")", DYNAMIC, false};
+        } else if (BinaryOpNode* node = dynamic_cast<BinaryOpNode*>(node_)) {
+            return binary_expression(node);
+        } else if (UnaryOpNode* node = dynamic_cast<UnaryOpNode*>(node_)) {
+            Code value = expression(node->expr);
+            if (node->op.type == Token::NOT) {
+                if (value.type == NATIVE_BOOL) return {"(!" + value.text + ")", NATIVE_BOOL, value.pure};
+                return {"compute_UnaryOp(Token::NOT, " + boxed(value) + ").boolean", NATIVE_BOOL, false};
+            }
+            if (node->op.type == Token::PLUS && value.type == NATIVE_INT) return value;
+            if (node->op.type == Token::MINUS && value.type == NATIVE_INT) return {"negate(" + value.text + ")", DYNAMIC, false};
+            return {"compute_UnaryOp(" + string(node->op.type == Token::PLUS ? "Token::PLUS" : "Token::MINUS") + ", " + boxed(value) + ")", DYNAMIC, false};
+        } else if (dynamic_cast<NoOp*>(node_)) {
+            return {"Value()", DYNAMIC, true};
+        }
+        throw runtime_error("Unknown AST node");
+    }
+
+    Code binary_expression(BinaryOpNode* node) {
+        Token::TokenType op = node->op.type;
+        Code left = expression(node->left);
+        Code right = expression(node->right);
+        if (is_short_circuit(op)) {
+            bool pure = left.pure && right.pure && left.type == NATIVE_BOOL && right.type == NATIVE_BOOL;
+            return {"(operand_bool(" + left.text + ")" + (op == Token::AND ? " && " : " || ") + "operand_bool(" + right.text + "))",
+                    NATIVE_BOOL, pure};
+        }
+        bool arithmetic = is_arithmetic(op);
+        CType type = arithmetic ? DYNAMIC : NATIVE_BOOL;
+        string function = string(arithmetic ? "binary<" : "compare<") + token_name(op) + ">";
+        /* When both operands can fail or have effects, the left one must go first */
+        if (!left.pure && !right.pure)
+            return {function + "(Values<2>{{" + boxed(left) + ", " + boxed(right) + "}})", type, false};
+        if (left.type == NATIVE_INT && right.type == NATIVE_INT) {
+            if (arithmetic) return {"int_binary<" + token_name(op) + ">(" + left.text + ", " + right.text + ")", DYNAMIC, false};
+            return {"(" + left.text + cpp_operator(op) + right.text + ")", NATIVE_BOOL, left.pure && right.pure};
+        }
+        if (left.type == NATIVE_BOOL && right.type == NATIVE_BOOL && (op == Token::EQUALS || op == Token::NOT_EQUALS))
+            return {"(" + left.text + cpp_operator(op) + right.text + ")", NATIVE_BOOL, left.pure && right.pure};
+        return {function + "(" + operand(left) + ", " + operand(right) + ")", type, false};
+    }
+
+    string condition(const Code& code) {
+        return code.type == NATIVE_BOOL ? code.text : "condition(" + code.text + ")";
+    }
+
+    void line(ostringstream& out, int indent, const string& text) {
+        out << string(indent * 4, ' ') << text << "\n";
+    }
+
+    void statement(AST* node_, ostringstream& out, int indent) {
+        if (node_ == nullptr) return;
+        if (BlockNode* node = dynamic_cast<BlockNode*>(node_)) {
+            for (AST* child : node->children) statement(child, out, indent);
+        } else if (FunctionCallNode* node = dynamic_cast<FunctionCallNode*>(node_)) {
+            line(out, indent, expression(node).text + ";");
+        } else if (ConditionalNode* node = dynamic_cast<ConditionalNode*>(node_)) {
+            for (size_t i = 0; i < node->conditions.size(); i++) {
+                string test = condition(expression(node->conditions[i]));
+                line(out, indent, (i == 0 ? "if (" : "} else if (") + test + ") {");
+                statement(node->bodies[i], out, indent + 1);
+            }
+            if (node->else_body != nullptr && dynamic_cast<NoOp*>(node->else_body) == nullptr) {
+                line(out, indent, "} else {");
+                statement(node->else_body, out, indent + 1);
+            }
+            line(out, indent, "}");
+        } else if (WhileNode* node = dynamic_cast<WhileNode*>(node_)) {
+            line(out, indent, "while (" + condition(expression(node->condition)) + ") {");
+            statement(node->body, out, indent + 1);
+            line(out, indent, "}");
+        } else if (ForRangeNode* node = dynamic_cast<ForRangeNode*>(node_)) {
+            /* All three bounds are evaluated before any is checked, as FOR_RANGE_SETUP does */
+            string bound[3], value[3];
+            AST* bounds[3] = {node->start, node->stop, node->step};
+            line(out, indent, "{");
+            for (int i = 0; i < 3; i++) {
+                bound[i] = "t_" + to_string(++temporaries);
+                Code code = expression(bounds[i]);
+                line(out, indent + 1, (code.type == NATIVE_INT ? "int64_t " : "Value ") + bound[i] + " = " + operand(code) + ";");
+            }
+            for (int i = 0; i < 3; i++) {
+                value[i] = "t_" + to_string(++temporaries);
+                line(out, indent + 1, "int64_t " + value[i] + " = " + (i < 2 ? "range_bound(" : "range_step(") + bound[i] + ");");
+            }
+            string counter = "t_" + to_string(++temporaries);
+            line(out, indent + 1, "for (int64_t " + counter + " = " + value[0] + "; range_continues(" + counter + ", " + value[1] + ", " + value[2] + ");) {");
+            store(out, indent + 2, node->variable->depth, node->variable->slot, {counter, NATIVE_INT, true});
+            line(out, indent + 2, "range_advance(" + counter + ", " + value[1] + ", " + value[2] + ");");
+            statement(node->body, out, indent + 2);
+            line(out, indent + 1, "}");
+            line(out, indent, "}");
+        } else if (ReturnNode* node = dynamic_cast<ReturnNode*>(node_)) {
+            FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(node->value);
+            if (current->node == nullptr) {
+                /* A return at module level ends the program, after evaluating its value */
+                if (dynamic_cast<NoOp*>(node->value) == nullptr) {
+                    Code value = expression(node->value);
+                    if (!value.pure) line(out, indent, "(void) " + value.text + ";");
+                }
+                line(out, indent, "return;");
+            } else if (dynamic_cast<NoOp*>(node->value)) {
+                line(out, indent, "return Value();");
+            } else if (call != nullptr && call->id != PRINT_SYMBOL) {
+                line(out, indent, "return tail_call(" + string(current->has_frame ? "frame" : "nullptr") + ", " + arguments(call) + ");");
+            } else {
+                line(out, indent, "return " + boxed(expression(node->value)) + ";");
+            }
+        } else if (FunctionNode* node = dynamic_cast<FunctionNode*>(node_)) {
+            string closure = "Value::make_function(new Closure(&" + by_node[node]->descriptor + ", "
+                           + (current->node == nullptr ? "module_frame" : "frame") + "))";
+            store(out, indent, node->depth, node->slot, {closure, DYNAMIC, false});
+        } else if (AssignNode* node = dynamic_cast<AssignNode*>(node_)) {
+            store(out, indent, node->left->depth, node->left->slot, expression(node->right));
+        } else if (dynamic_cast<NoOp*>(node_)) {
+            return;
+        } else throw runtime_error("Unknown AST node");
+    }
+
+    /* Declares the slots of the current function that are C++ locals and are read */
+    void declare_locals(ostringstream& out, bool module) {
+        for (size_t i = 0; i < current->slots.size(); i++) {
+            const Slot& slot = current->slots[i];
+            string name = "v_" + symbol_name(slot.name);
+            bool parameter = !module && i < current->node->parameters.size();
+            if (!slot.captured && !slot.read) continue;
+            current->uses_arguments |= parameter;
+            if (parameter && slot.captured) line(out, 1, "frame->slots[" + to_string(i) + "] = move(arguments[" + to_string(i) + "]);");
+            else if (parameter) line(out, 1, "Value " + name + " = move(arguments[" + to_string(i) + "]);");
+            else if (slot.captured) continue;
+            else if (slot.type == NATIVE_INT) line(out, 1, "int64_t " + name + " = 0;");
+            else if (slot.type == NATIVE_BOOL) line(out, 1, "bool " + name + " = false;");
+            else line(out, 1, "Value " + name + " = Value::unbound();");
+        }
+    }
+
+    /* The parameters the function does not use are left unnamed, which -Wunused-parameter accepts */
+    void write_function(Function* function, ostringstream& out) {
+        current = function;
+        ostringstream body;
+        if (function->has_frame) {
+            line(body, 1, "Scope* frame = new Scope(env, " + to_string(function->slots.size()) + ", nullptr);");
+            line(body, 1, "FrameExit frame_exit(frame);");
+            function->uses_env = true;
+        }
+        declare_locals(body, false);
+        statement(function->node->function_body, body, 1);
+        line(body, 1, "return Value();");
+        out << "static Value " << function->name << "(Scope*" << (function->uses_env ? " env" : "")
+            << ", Value*" << (function->uses_arguments ? " arguments" : "") << ") {\n" << body.str() << "}\n\n";
+    }
+
+  public:
+    size_t RECURSION_LIMIT = 10000;
+
+    Transpiler(const vector<Symbol>& globals) : globals(globals) {}
+    Transpiler(const Transpiler&) = delete;
+    ~Transpiler() {
+        for (Function* function : functions) delete function;
+    }
+
+    /* Writes the translation unit for a resolved tree */
+    void emit(AST* tree, ostream& out) {
+        vector<Function*> chain(1, add_function(nullptr, globals));
+        scan(tree, chain);
+        for (Function* function : functions) {
+            Flow flow;
+            flow.assigned.assign(function->slots.size(), 0);
+            if (function->node == nullptr) {
+                flow_statement(tree, flow, function);
+            } else {
+                for (size_t i = 0; i < function->node->parameters.size(); i++) flow.assigned[i] = 1;
+                flow_statement(function->node->function_body, flow, function);
+            }
+        }
+        infer_types();
+
+        ostringstream bodies;
+        for (size_t i = 1; i < functions.size(); i++) write_function(functions[i], bodies);
+        current = functions[0];
+        bodies << "static void run_module() {\n";
+        declare_locals(bodies, true);
+        statement(tree, bodies, 1);
+        bodies << "}\n";
+
+        out << "/* Written by mypython.exe --emit-cpp. Build with compile.sh, or with\n"
+            << "   g++ -std=c++11 -O2 -pthread -I native this_file.cpp */\n\n"
+            << "#include \"runtime.cpp\"\n\n";
+        for (const string& declaration : constants) out << declaration << "\n";
+        if (!constants.empty()) out << "\n";
+        bool shared = false;
+        for (const Slot& slot : functions[0]->slots) {
+            if (!slot.captured) continue;
+            out << "static Value g_" << symbol_name(slot.name) << " = Value::unbound();\n";
+            shared = true;
+        }
+        if (shared) out << "\n";
+        for (size_t i = 1; i < functions.size(); i++) out << "static Value " << functions[i]->name << "(Scope* env, Value* arguments);\n";
+        for (size_t i = 1; i < functions.size(); i++) {
+            Function* function = functions[i];
+            out << "static FunctionNode " << function->descriptor << " = {" << literal(symbol_name(function->node->id)) << ", "
+                << function->node->parameters.size() << ", &" << function->name << "};\n";
+        }
+        if (functions.size() > 1) out << "\n";
+        out << bodies.str() << "\n"
+            << "int main() {\n"
+            << "    return run_compiled(&run_module, " << RECURSION_LIMIT << ");\n"
+            << "}\n";
+    }
+};
+
+#endif
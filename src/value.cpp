@@ -0,0 +1,223 @@
+#ifndef VALUE_CPP
+#define VALUE_CPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class FunctionNode;
+struct Closure;
+struct BigInt;
+
+/* Immutable string shared between Values by reference count. Concatenating long strings makes a rope
+   node that only holds its two halves, so building a string piece by piece is linear. The text of a
+   rope is built the first time it is read, and the halves are dropped then. The length is known up
+   front and the hash is computed once, so comparing strings of different lengths reads no text */
+struct StringObject {
+    /* Shorter concatenations are copied straight away */
+    static const size_t ROPE_THRESHOLD = 256;
+
+    int refs;
+    size_t length;
+
+    StringObject(string t) : refs(1), length(t.size()), text(move(t)) {}
+    StringObject(StringObject* left, StringObject* right) : refs(1), length(left->length + right->length), left(left), right(right) {
+        left->refs++;
+        right->refs++;
+    }
+    StringObject(const StringObject&) = delete;
+
+    const string& flat() const {
+        if (left != nullptr) flatten();
+        return text;
+    }
+
+    size_t hash() const {
+        if (!hashed) {
+            hash_value = std::hash<string>()(flat());
+            hashed = true;
+        }
+        return hash_value;
+    }
+
+    /* Returns a new reference to a string holding a's text followed by b's */
+    static StringObject* concat(StringObject* a, StringObject* b) {
+        StringObject* only = b->length == 0 ? a : a->length == 0 ? b : nullptr;
+        if (only != nullptr) {
+            only->refs++;
+            return only;
+        }
+        if (a->length + b->length < ROPE_THRESHOLD) return new StringObject(a->flat() + b->flat());
+        return new StringObject(a, b);
+    }
+
+    static bool equal(const StringObject* a, const StringObject* b) {
+        if (a == b) return true;
+        if (a->length != b->length) return false;
+        if (a->hashed && b->hashed && a->hash_value != b->hash_value) return false;
+        return a->flat() == b->flat();
+    }
+
+    /* Drops a reference. Ropes are freed with a worklist, since a string built from many pieces is a
+       chain of nodes far deeper than the native stack */
+    static void release(StringObject* object) {
+        if (--object->refs > 0) return;
+        if (object->left == nullptr) {
+            delete object;
+            return;
+        }
+        vector<StringObject*> dead(1, object);
+        while (!dead.empty()) {
+            StringObject* node = dead.back();
+            dead.pop_back();
+            if (node->left != nullptr && --node->left->refs == 0) dead.push_back(node->left);
+            if (node->right != nullptr && --node->right->refs == 0) dead.push_back(node->right);
+            delete node;
+        }
+    }
+
+  private:
+    mutable string text;
+    mutable StringObject* left = nullptr;
+    mutable StringObject* right = nullptr;
+    mutable size_t hash_value = 0;
+    mutable bool hashed = false;
+
+    /* Copies the leaves in order, walking the rope with an explicit stack */
+    void flatten() const {
+        string result;
+        result.reserve(length);
+        vector<const StringObject*> pending(1, this);
+        while (!pending.empty()) {
+            const StringObject* node = pending.back();
+            pending.pop_back();
+            if (node->left == nullptr) result += node->text;
+            else {
+                pending.push_back(node->right);
+                pending.push_back(node->left);
+            }
+        }
+        text = move(result);
+        StringObject* halves[2] = {left, right};
+        left = right = nullptr;
+        release(halves[0]);
+        release(halves[1]);
+    }
+};
+
+/* Runtime value of the interpreter. Bools and integers that fit a machine word are held inline, strings,
+   functions and larger integers by handle. An integer is a BIGINT only when it does not fit an int64_t */
+class Value {
+  public:
+    enum Type : unsigned char { NONE, BOOL, INT, STRING, FUNCTION, UNBOUND, BIGINT };
+    Type type;
+    union {
+        bool boolean;
+        int64_t integer;
+        StringObject* str;
+        Closure* closure;
+        BigInt* big;
+    };
+
+    Value() : type(NONE), integer(0) {}
+    Value(const Value& other) : type(other.type), integer(0) {
+        copy_payload(other);
+        retain();
+    }
+    Value(Value&& other) : type(other.type), integer(0) {
+        copy_payload(other);
+        other.type = NONE;
+    }
+    ~Value() { release(); }
+
+    Value& operator=(const Value& other) {
+        other.retain();
+        release();
+        type = other.type;
+        copy_payload(other);
+        return *this;
+    }
+    Value& operator=(Value&& other) {
+        if (this != &other) {
+            release();
+            type = other.type;
+            copy_payload(other);
+            other.type = NONE;
+        }
+        return *this;
+    }
+
+    static Value make_bool(bool b) {
+        Value value;
+        value.type = BOOL;
+        value.boolean = b;
+        return value;
+    }
+    static Value make_int(int64_t i) {
+        Value value;
+        value.type = INT;
+        value.integer = i;
+        return value;
+    }
+    static Value make_string(string text) {
+        Value value;
+        value.type = STRING;
+        value.str = new StringObject(move(text));
+        return value;
+    }
+    /* Takes over the reference the caller holds on the string */
+    static Value make_string(StringObject* s) {
+        Value value;
+        value.type = STRING;
+        value.str = s;
+        return value;
+    }
+    /* Takes over the reference the caller holds on the closure */
+    static Value make_function(Closure* c) {
+        Value value;
+        value.type = FUNCTION;
+        value.closure = c;
+        return value;
+    }
+    /* Takes over the reference the caller holds on the integer, which must not fit an int64_t */
+    static Value make_big(BigInt* b) {
+        Value value;
+        value.type = BIGINT;
+        value.big = b;
+        return value;
+    }
+    /* Marks a frame slot that has not been assigned yet */
+    static Value unbound() {
+        Value value;
+        value.type = UNBOUND;
+        return value;
+    }
+
+    bool is_none() const { return type == NONE; }
+    bool is_unbound() const { return type == UNBOUND; }
+    bool is_integer() const { return type == INT || type == BIGINT; }
+    const string& text() const { return str->flat(); }
+
+  private:
+    void copy_payload(const Value& other) {
+        switch (other.type) {
+            case BOOL:     boolean = other.boolean; break;
+            case INT:      integer = other.integer; break;
+            case STRING:   str = other.str; break;
+            case FUNCTION: closure = other.closure; break;
+            case BIGINT:   big = other.big; break;
+            default:       break;
+        }
+    }
+    inline void retain() const;
+    inline void release();
+};
+
+/* Scope and Closure complete Value::retain and Value::release */
+#include "scope.cpp"
+
+#endif
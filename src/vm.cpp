@@ -0,0 +1,398 @@
+#ifndef VM_CPP
+#define VM_CPP
+
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "ast.cpp"
+#include "compiler.cpp"
+#include "memo.cpp"
+#include "operations.cpp"
+#include "output.cpp"
+#include "profiler.cpp"
+#include "scope.cpp"
+#include "value.cpp"
+
+using namespace std;
+
+/* GCC and Clang dispatch through a table of label addresses, everything else through a switch. A computed
+   goto leaves a handler's block without running destructors, so no handler keeps a local that owns a value
+   across DISPATCH(); work that needs one goes in a member function */
+#if defined(__GNUC__) && !defined(MYPYTHON_SWITCH_DISPATCH)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+/* Saved state of a caller. memo is the table the callee's result goes into, when the callee is pure, and
+   callee is the scope of the call, which a tail call replaces */
+struct Frame {
+    CodeObject* code;
+    Instruction* ip;
+    Scope* scope;
+    MemoTable* memo;
+    Scope* callee;
+};
+
+/* Stack machine that runs the CodeObjects produced by the Compiler */
+class VM {
+  private:
+    OutputSink& out;
+    vector<Value> stack;
+    vector<Frame> frames;
+    vector<vector<Value>> memo_keys;
+
+    Value pop() {
+        Value value = move(stack.back());
+        stack.pop_back();
+        return value;
+    }
+
+    /* Stores the return value on top of the stack as the result of the innermost memoized call */
+    void remember(MemoTable* memo) {
+        memo->insert(move(memo_keys.back()), stack.back());
+        memo_keys.pop_back();
+    }
+
+    void name_error(Scope* owner, int slot) {
+        throw runtime_error("NameError: \"" + owner->name(slot) + "\"");
+    }
+
+    /* Answers a call to a memoized function from its table, replacing the callee and its arguments with the
+       result. On a miss the arguments are kept as the key the result goes in, when keep_key is set */
+    bool answer_from_memo(MemoTable* memo, FunctionNode* function, size_t base, bool keep_key) {
+        vector<Value> key(stack.begin() + base, stack.end());
+        if (const Value* remembered = memo->lookup(key)) {
+            if (profiler != nullptr) profiler->memo_hit(function);
+            Value result = *remembered;
+            stack.resize(base - 1);
+            stack.push_back(move(result));
+            return true;
+        }
+        if (keep_key) memo_keys.push_back(move(key));
+        return false;
+    }
+
+    /* Exits the scopes of the calls an error interrupted, innermost first as their returns would have */
+    void release_frames() {
+        while (!frames.empty()) {
+            Scope::exit(frames.back().callee);
+            frames.pop_back();
+        }
+        stack.clear();
+        memo_keys.clear();
+    }
+
+    void print(int count) {
+        out.print(stack.data() + stack.size() - count, count);
+        stack.resize(stack.size() - count);
+    }
+
+  public:
+    size_t recursion_limit;
+    Profiler* profiler = nullptr;
+    /* Rewrite BINARY_OP and UNARY_OP in place into the quickened form for the operands they first see */
+    bool quicken = true;
+    long long quickened = 0;
+    long long deoptimized = 0;
+    /* Called with loader for a function that has no code yet because its body was only skimmed; it must
+       leave the function compiled */
+    void (*load_function)(void* loader, FunctionNode* function) = nullptr;
+    void* loader = nullptr;
+
+    VM(size_t recursion_limit, OutputSink& out) : out(out), recursion_limit(recursion_limit) {}
+
+    /* An error leaves run() with calls still active, and their frames are let go before it goes on. The
+       dispatch loop is a function of its own since a try block around it slows every instruction */
+    int run(CodeObject* module, Scope* globals) {
+        try {
+            return dispatch(module, globals);
+        } catch (...) {
+            release_frames();
+            throw;
+        }
+    }
+
+    int dispatch(CodeObject* module, Scope* globals) {
+        CodeObject* code = module;
+        Instruction* ip = code->code.data();
+        Scope* scope = globals;
+        Instruction* ins;
+
+#if USE_COMPUTED_GOTO
+        static void* dispatch_table[] = {
+            &&op_LOAD_CONST, &&op_LOAD_NONE, &&op_LOAD_FAST, &&op_LOAD_DEREF, &&op_LOAD_GLOBAL,
+            &&op_STORE_FAST, &&op_STORE_GLOBAL, &&op_BINARY_OP, &&op_UNARY_OP, &&op_JUMP,
+            &&op_JUMP_IF_FALSE, &&op_MAKE_FUNCTION, &&op_CALL, &&op_TAIL_CALL, &&op_PRINT, &&op_POP,
+            &&op_RETURN, &&op_RETURN_NONE, &&op_LINE, &&op_BINARY_QUICK, &&op_UNARY_QUICK,
+            &&op_JUMP_IF_FALSE_OR_POP, &&op_JUMP_IF_TRUE_OR_POP, &&op_CHECK_BOOL, &&op_FOR_RANGE_SETUP,
+            &&op_FOR_RANGE
+        };
+#define TARGET(op) op_##op:
+#define DISPATCH() do { ins = ip++; goto *dispatch_table[ins->op]; } while (0)
+        DISPATCH();
+#else
+#define TARGET(op) case op:
+#define DISPATCH() break
+        for (;;) {
+        ins = ip++;
+        switch (ins->op) {
+#endif
+            TARGET(LOAD_CONST) {
+                stack.push_back(code->constants[ins->a]);
+                DISPATCH();
+            }
+            TARGET(LOAD_NONE) {
+                stack.push_back(Value());
+                DISPATCH();
+            }
+            TARGET(LOAD_FAST) {
+                const Value& value = scope->slots[ins->a];
+                if (value.is_unbound()) name_error(scope, ins->a);
+                stack.push_back(value);
+                DISPATCH();
+            }
+            TARGET(LOAD_DEREF) {
+                Scope* owner = scope;
+                for (int depth = ins->b; depth > 0; depth--) owner = owner->parent;
+                const Value& value = owner->slots[ins->a];
+                if (value.is_unbound()) name_error(owner, ins->a);
+                stack.push_back(value);
+                DISPATCH();
+            }
+            TARGET(LOAD_GLOBAL) {
+                const Value& value = globals->slots[ins->a];
+                if (value.is_unbound()) name_error(globals, ins->a);
+                stack.push_back(value);
+                DISPATCH();
+            }
+            TARGET(STORE_FAST) {
+                scope->slots[ins->a] = pop();
+                DISPATCH();
+            }
+            TARGET(STORE_GLOBAL) {
+                globals->slots[ins->a] = pop();
+                DISPATCH();
+            }
+            TARGET(BINARY_OP)
+            binary_op: {
+                Value& left = stack[stack.size() - 2];
+                if (ins->b == QUICK_UNSEEN && quicken) {
+                    QuickOp quick = specialize_BinaryOp(left, (Token::TokenType) ins->a, stack.back());
+                    ins->b = quick;
+                    if (quick != QUICK_GENERIC) {
+                        ins->op = BINARY_QUICK;
+                        quickened++;
+                    }
+                }
+                left = compute_BinaryOp(left, (Token::TokenType) ins->a, stack.back());
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(UNARY_OP)
+            unary_op: {
+                if (ins->b == QUICK_UNSEEN && quicken) {
+                    QuickOp quick = specialize_UnaryOp((Token::TokenType) ins->a, stack.back());
+                    ins->b = quick;
+                    if (quick != QUICK_GENERIC) {
+                        ins->op = UNARY_QUICK;
+                        quickened++;
+                    }
+                }
+                stack.back() = compute_UnaryOp((Token::TokenType) ins->a, stack.back());
+                DISPATCH();
+            }
+            TARGET(BINARY_QUICK) {
+                QuickOp quick = (QuickOp) ins->b;
+                Value::Type type = quick_operand_type(quick);
+                Value& left = stack[stack.size() - 2];
+                if (left.type != type || stack.back().type != type) {
+                    ins->op = BINARY_OP;
+                    ins->b = QUICK_GENERIC;
+                    deoptimized++;
+                    goto binary_op;
+                }
+                left = compute_QuickBinary(quick, left, stack.back());
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(UNARY_QUICK) {
+                QuickOp quick = (QuickOp) ins->b;
+                if (stack.back().type != quick_operand_type(quick)) {
+                    ins->op = UNARY_OP;
+                    ins->b = QUICK_GENERIC;
+                    deoptimized++;
+                    goto unary_op;
+                }
+                stack.back() = compute_QuickUnary(quick, stack.back());
+                DISPATCH();
+            }
+            TARGET(JUMP) {
+                ip = code->code.data() + ins->a;
+                DISPATCH();
+            }
+            TARGET(JUMP_IF_FALSE) {
+                if (stack.back().type != Value::BOOL)
+                    throw runtime_error("Invalid condition type");
+                if (!stack.back().boolean) ip = code->code.data() + ins->a;
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(JUMP_IF_FALSE_OR_POP) {
+                if (decides_short_circuit(Token::AND, stack.back())) ip = code->code.data() + ins->a;
+                else stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(JUMP_IF_TRUE_OR_POP) {
+                if (decides_short_circuit(Token::OR, stack.back())) ip = code->code.data() + ins->a;
+                else stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(CHECK_BOOL) {
+                short_circuit_result(stack.back());
+                DISPATCH();
+            }
+            TARGET(FOR_RANGE_SETUP) {
+                size_t top = stack.size();
+                range_bound(stack[top - 3]);
+                range_bound(stack[top - 2]);
+                range_step(stack[top - 1]);
+                DISPATCH();
+            }
+            TARGET(FOR_RANGE) {
+                /* The counter is advanced in place, so the loop allocates nothing per pass */
+                Value* state = &stack[stack.size() - 3];
+                if (!range_continues(state[0].integer, state[1].integer, state[2].integer)) {
+                    stack.resize(stack.size() - 3);
+                    ip = code->code.data() + ins->a;
+                    DISPATCH();
+                }
+                int64_t counter = state[0].integer;
+                range_advance(state[0].integer, state[1].integer, state[2].integer);
+                stack.push_back(Value::make_int(counter));
+                DISPATCH();
+            }
+            TARGET(MAKE_FUNCTION) {
+                stack.push_back(Value::make_function(new Closure(code->functions[ins->a], scope)));
+                DISPATCH();
+            }
+            TARGET(CALL)
+            call: {
+                if (frames.size() >= recursion_limit)
+                    throw runtime_error("RecursionError: maximum recursion depth exceeded");
+                size_t base = stack.size() - ins->b;
+                const Value& callee = stack[base - 1];
+                if (callee.type != Value::FUNCTION)
+                    throw runtime_error("Invalid function");
+                FunctionNode* function_def = callee.closure->function;
+                if (function_def->get_num_parameters() != ins->b)
+                    throw runtime_error("Invalid number of parameters");
+                if (function_def->code == nullptr) load_function(loader, function_def);
+
+                MemoTable* memo = function_def->memo;
+                if (memo != nullptr && answer_from_memo(memo, function_def, base, true)) DISPATCH();
+
+                Scope* child = new Scope(callee.closure->env, function_def->locals.size(), &function_def->locals);
+                for (int i = 0; i < ins->b; i++) {
+                    child->slots[i] = move(stack[base + i]);
+                }
+                stack.resize(base - 1);
+
+                frames.push_back({code, ip, scope, memo, child});
+                code = function_def->code;
+                ip = code->code.data();
+                scope = child;
+                if (profiler != nullptr) profiler->enter(function_def);
+                DISPATCH();
+            }
+            TARGET(TAIL_CALL) {
+                /* The current frame is replaced unless something still needs it after the callee returns:
+                   at module level, or when the callee was defined in this frame, this is an ordinary CALL
+                   and the RETURN after it runs. A memoized callee still answers from its table, but a
+                   result computed by a tail call is not added to it */
+                size_t base = stack.size() - ins->b;
+                const Value& callee = stack[base - 1];
+                if (frames.empty() || callee.type != Value::FUNCTION || callee.closure->env == scope)
+                    goto call;
+                FunctionNode* function_def = callee.closure->function;
+                if (function_def->memo != nullptr && answer_from_memo(function_def->memo, function_def, base, false)) DISPATCH();
+                if (function_def->get_num_parameters() != ins->b)
+                    throw runtime_error("Invalid number of parameters");
+                if (function_def->code == nullptr) load_function(loader, function_def);
+
+                if (scope->refs == 1 && scope->names == &function_def->locals && scope->parent == callee.closure->env) {
+                    /* Self tail call: rebind the parameters in place and clear the other locals */
+                    for (int i = 0; i < ins->b; i++) {
+                        scope->slots[i] = move(stack[base + i]);
+                    }
+                    for (size_t i = ins->b; i < scope->slots.size(); i++) {
+                        scope->slots[i] = Value::unbound();
+                    }
+                } else {
+                    Scope* child = new Scope(callee.closure->env, function_def->locals.size(), &function_def->locals);
+                    for (int i = 0; i < ins->b; i++) {
+                        child->slots[i] = move(stack[base + i]);
+                    }
+                    Scope::exit(scope);
+                    scope = frames.back().callee = child;
+                }
+                stack.resize(base - 1 - ins->a);
+                code = function_def->code;
+                ip = code->code.data();
+                if (profiler != nullptr) profiler->tail_call(function_def);
+                DISPATCH();
+            }
+            TARGET(PRINT) {
+                print(ins->b);
+                stack.push_back(Value());
+                DISPATCH();
+            }
+            TARGET(POP) {
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(RETURN) {
+                if (frames.empty()) return 0;
+                if (ins->a > 0) {
+                    stack[stack.size() - 1 - ins->a] = move(stack.back());
+                    stack.resize(stack.size() - ins->a);
+                }
+                Scope::exit(scope);
+                Frame& caller = frames.back();
+                if (caller.memo != nullptr) remember(caller.memo);
+                code = caller.code;
+                ip = caller.ip;
+                scope = caller.scope;
+                frames.pop_back();
+                if (profiler != nullptr) profiler->leave();
+                DISPATCH();
+            }
+            TARGET(RETURN_NONE) {
+                if (frames.empty()) return 0;
+                stack.resize(stack.size() - ins->a);
+                stack.push_back(Value());
+                Scope::exit(scope);
+                Frame& caller = frames.back();
+                if (caller.memo != nullptr) remember(caller.memo);
+                code = caller.code;
+                ip = caller.ip;
+                scope = caller.scope;
+                frames.pop_back();
+                if (profiler != nullptr) profiler->leave();
+                DISPATCH();
+            }
+            TARGET(LINE) {
+                profiler->line(ins->a);
+                DISPATCH();
+            }
+#if !USE_COMPUTED_GOTO
+        }
+        }
+#endif
+#undef TARGET
+#undef DISPATCH
+        return 0;
+    }
+};
+
+#endif
@@ -1,23 +1,94 @@
 import os
+import resource
 import subprocess
+import sys
+import time
 
 test_directory = 'testcases/phase2'
 output_directory = 'testcases/output/'
 
+# --tree runs the AST walker instead of the bytecode VM
+# --compare runs both, diffs their output and reports the time each one took
+# --batch runs every test in one process on all cores with mypython.exe --batch
+# --cpp compiles each test to a native program with compile.sh and runs that
+tree_mode = '--tree' in sys.argv
+cpp = '--cpp' in sys.argv
+compare = '--compare' in sys.argv
+batch = '--batch' in sys.argv
+repeat = 20
+
+if batch:
+    sys.exit(subprocess.run(['./mypython.exe', '--batch', test_directory] + (['--tree'] if tree_mode else [])).returncode)
+
+def run(input_filepath, flags, stdout):
+    start = time.perf_counter()
+    subprocess.run(['./mypython.exe'] + flags + [input_filepath], stdout=stdout)
+    return time.perf_counter() - start
+
 if not os.path.exists(output_directory):
     os.mkdir(output_directory)
 
+totals = {'vm': 0.0, 'tree': 0.0}
 for filename in sorted(os.listdir(test_directory)):
     if not filename.startswith('in'): continue
     test_number = filename[2:filename.find('.')]
     input_filepath = os.path.join(test_directory, filename)
     output_filepath = os.path.join(output_directory, 'out{}.txt'.format(test_number))
     verify_filepath = input_filepath.replace('in', 'out').replace('.py', '.txt')
+    if compare:
+        outputs = {}
+        for mode, flags in (('vm', []), ('tree', ['--tree'])):
+            for _ in range(repeat):
+                totals[mode] += run(input_filepath, flags, subprocess.DEVNULL)
+            outputs[mode] = subprocess.run(['./mypython.exe'] + flags + [input_filepath], stdout=subprocess.PIPE).stdout
+        status = 'match' if outputs['vm'] == outputs['tree'] else 'differ'
+        print('Test {} outputs {}.'.format(test_number, status))
+        continue
     with open(output_filepath, 'w') as file:
-        subprocess.run(['./mypython.exe', input_filepath], stdout=file)
+        if cpp:
+            program = os.path.join(output_directory, 'in{}'.format(test_number))
+            subprocess.run(['./compile.sh', input_filepath, program], check=True)
+            subprocess.run([program], stdout=file)
+        else:
+            run(input_filepath, ['--tree'] if tree_mode else [], file)
         file.close()
     with open(output_filepath, 'r') as file1, open(verify_filepath, 'r') as file2:
         status = 'passed' if file1.readlines() == file2.readlines() else 'failed'
         print('Test {} {}.'.format(test_number, status))
         file1.close()
-        file2.close()
\ No newline at end of file
+        file2.close()
+
+# Calls nested one less and one more than the default recursion limit of 10000: the first returns, the second
+# raises RecursionError after the output before it instead of overflowing the native stack
+if not compare and not cpp:
+    recursion_limit = 10000
+    recursion_script = os.path.join(output_directory, 'recursion.py')
+    with open(recursion_script, 'w') as file:
+        file.write('def d(n):\n    if n == 0:\n        return 0\n    return 1 + d(n - 1)\n')
+        file.write('print(d({}))\nprint(d({}))\n'.format(recursion_limit - 2, recursion_limit))
+    result = subprocess.run(['./mypython.exe'] + (['--tree'] if tree_mode else []) + [recursion_script], capture_output=True)
+    ok = (result.returncode == 1 and result.stdout == '{}\n'.format(recursion_limit - 2).encode()
+          and result.stderr == b'RecursionError: maximum recursion depth exceeded\n')
+    print('Recursion limit test {}.'.format('passed' if ok else 'failed'))
+
+    # The same failing script run many times in one --batch process: each run that stops with an error must let
+    # go of the frames of the calls it was in, so the peak memory of the batch does not grow with the count
+    def peak_megabytes(count):
+        directory = os.path.join(output_directory, 'errors{}'.format(count))
+        if not os.path.exists(directory):
+            os.mkdir(directory)
+        for i in range(count):
+            with open(recursion_script) as source, open(os.path.join(directory, 'e{}.py'.format(i)), 'w') as file:
+                file.write(source.read())
+        result = subprocess.run(['./mypython.exe', '--jobs', '1', '--batch', directory] + (['--tree'] if tree_mode else []),
+                                capture_output=True)
+        errors = result.stderr.count(b'RecursionError')
+        return result.returncode == 1 and errors == count, resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss / 1024
+    single_ok, single = peak_megabytes(1)
+    many_ok, many = peak_megabytes(40)
+    ok = single_ok and many_ok and many < single + 8
+    print('Error memory test {} ({:.1f} MB for 1 failing script, {:.1f} MB for 40).'.format('passed' if ok else 'failed', single, many))
+
+if compare:
+    for mode in ('vm', 'tree'):
+        print('{}: {:.3f}s over {} runs per test'.format(mode, totals[mode], repeat))
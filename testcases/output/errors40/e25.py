@@ -0,0 +1,6 @@
+def d(n):
+    if n == 0:
+        return 0
+    return 1 + d(n - 1)
+print(d(9998))
+print(d(10000))